@@ -7,14 +7,27 @@ parser = argparse.ArgumentParser(description = "Generate random numbers file")
 parser.add_argument('-f', type=str, required=True, help="file name")
 parser.add_argument('-c', type=int, required=True, help='number count')
 parser.add_argument('-m', type=int, default=maxint, help='maximal number')
+parser.add_argument('-o', type=str, default='random',
+                    choices=['random', 'descending', 'nearly-sorted'],
+                    help='order of numbers: descending has duplicates when '
+                         '-m is less than -c, nearly-sorted has two '
+                         'neighbours swapped every ~2000 numbers')
 args = parser.parse_args()
 random.seed()
 
+numbers = [random.randint(0, args.m) for i in range(0, args.c)]
+if args.o == 'descending':
+    numbers.sort(reverse=True)
+elif args.o == 'nearly-sorted':
+    numbers.sort()
+    for i in range(0, args.c - 1, 2000):
+        k = random.randint(i, min(i + 1998, args.c - 2))
+        numbers[k], numbers[k + 1] = numbers[k + 1], numbers[k]
 
 f = open(args.f, 'w')
 
 for i in range(0, args.c):
-    f.write(str(random.randint(0, args.m)))
+    f.write(str(numbers[i]))
     if i + 1 != args.c:
         f.write(' ')
 
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "libjob.h"
+
+// Files smaller than that are never split
+#define MIN_JOB_SIZE (4 << 20)
+// Several jobs per worker let the largest-first order balance the tail
+#define JOBS_PER_WORKER 4
+#define INITIAL_JOBS_CAPACITY 8
+
+/* Moves the position forward to the first separator, so that no number is cut in half. */
+static uint64_t align_on_separator(FILE *const file, const uint64_t pos, const uint64_t size)
+{
+    if (pos >= size) {
+        return size;
+    }
+    fseek(file, (long) pos, SEEK_SET);
+    uint64_t aligned = pos;
+    int ch;
+    while ((ch = getc_unlocked(file)) != EOF && !isspace(ch)) {
+        aligned++;
+    }
+    return aligned < size ? aligned : size;
+}
+
+static void add_job(job_queue *const q, size_t *const capacity, const char *const name,
+                    const uint64_t offset, const uint64_t len)
+{
+    if (q->count == *capacity) {
+        *capacity *= 2;
+        q->jobs = (sort_job *) realloc(q->jobs, *capacity * sizeof(sort_job));
+    }
+    sort_job *job = &q->jobs[q->count++];
+    job->filename = name;
+    job->offset = offset;
+    job->len = len;
+    job->sorted_output = NULL;
+    job->status = SORTING_WAITING;
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    const sort_job *left = (const sort_job *) a;
+    const sort_job *right = (const sort_job *) b;
+    if (left->len != right->len) {
+        return left->len > right->len ? -1 : 1;
+    }
+    return 0;
+}
+
+bool job_queue_init(job_queue *const q, char **const names, const size_t names_count, const size_t workers)
+{
+    uint64_t *sizes = (uint64_t *) calloc(names_count, sizeof(uint64_t));
+    uint64_t total_size = 0;
+    for (size_t i = 0; i < names_count; i++) {
+        struct stat st;
+        if (stat(names[i], &st) != 0) {
+            printf("Failed to open %s: %s\n", names[i], strerror(errno));
+            free(sizes);
+            return false;
+        }
+        sizes[i] = (uint64_t) st.st_size;
+        total_size += sizes[i];
+    }
+
+    uint64_t job_size = total_size / ((workers > 0 ? workers : 1) * JOBS_PER_WORKER);
+    if (job_size < MIN_JOB_SIZE) {
+        job_size = MIN_JOB_SIZE;
+    }
+
+    size_t capacity = INITIAL_JOBS_CAPACITY;
+    q->jobs = (sort_job *) calloc(capacity, sizeof(sort_job));
+    q->count = 0;
+    q->next = 0;
+    for (size_t i = 0; i < names_count; i++) {
+        if (sizes[i] <= job_size) {
+            add_job(q, &capacity, names[i], 0, sizes[i]);
+            continue;
+        }
+
+        FILE *file = fopen(names[i], "r");
+        if (file == NULL) {
+            printf("Failed to open %s: %s\n", names[i], strerror(errno));
+            free(sizes);
+            job_queue_free(q);
+            return false;
+        }
+        uint64_t offset = 0;
+        while (offset < sizes[i]) {
+            uint64_t end = align_on_separator(file, offset + job_size, sizes[i]);
+            add_job(q, &capacity, names[i], offset, end - offset);
+            offset = end;
+        }
+        fclose(file);
+    }
+    free(sizes);
+
+    qsort(q->jobs, q->count, sizeof(sort_job), compare_jobs);
+    return true;
+}
+
+sort_job *job_queue_next(job_queue *const q)
+{
+    while (q->next < q->count) {
+        sort_job *job = &q->jobs[q->next++];
+        if (job->status == SORTING_WAITING) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+void job_queue_free(job_queue *const q)
+{
+    free(q->jobs);
+    q->jobs = NULL;
+    q->count = 0;
+    q->next = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef ASSIGNMENT_1_LIBJOB_H
+#define ASSIGNMENT_1_LIBJOB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    SORTING_WAITING,
+    SORTING_IN_PROGRESS,
+    SORTING_FINISHED,
+} sorting_status;
+
+// Byte range of an input file, starts and ends on separators between numbers
+typedef struct {
+    const char *filename;
+    uint64_t offset;
+    uint64_t len;
+
+    FILE *sorted_output;
+    sorting_status status;
+} sort_job;
+
+// Jobs sorted from the largest to the smallest one, so that workers finish at about the same time
+typedef struct {
+    sort_job *jobs;
+    size_t count;
+    size_t next;
+} job_queue;
+
+bool job_queue_init(job_queue *const q, char **const names, const size_t names_count, const size_t workers);
+sort_job *job_queue_next(job_queue *const q);
+void job_queue_free(job_queue *const q);
+
+#endif //ASSIGNMENT_1_LIBJOB_H
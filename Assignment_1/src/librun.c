@@ -0,0 +1,163 @@
+#include <ctype.h>
+
+#include "librun.h"
+
+#define VARINT_PAYLOAD_BITS 7
+#define VARINT_PAYLOAD_MASK 0x7F
+#define VARINT_CONTINUATION 0x80
+
+static run_format spill_format = RUN_FORMAT_TEXT;
+
+void run_set_spill_format(const run_format format)
+{
+    spill_format = format;
+}
+
+run_format run_get_spill_format()
+{
+    return spill_format;
+}
+
+static uint64_t zigzag_encode(const int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t zigzag_decode(const uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static void write_varint(FILE *const file, uint64_t value)
+{
+    while (value > VARINT_PAYLOAD_MASK) {
+        putc_unlocked((int) ((value & VARINT_PAYLOAD_MASK) | VARINT_CONTINUATION), file);
+        value >>= VARINT_PAYLOAD_BITS;
+    }
+    putc_unlocked((int) value, file);
+}
+
+static bool read_varint(FILE *const file, uint64_t *const value)
+{
+    uint64_t result = 0;
+    unsigned shift = 0;
+    int byte;
+    while ((byte = getc_unlocked(file)) != EOF) {
+        result |= (uint64_t) (byte & VARINT_PAYLOAD_MASK) << shift;
+        if ((byte & VARINT_CONTINUATION) == 0) {
+            *value = result;
+            return true;
+        }
+        shift += VARINT_PAYLOAD_BITS;
+    }
+    return false;
+}
+
+void run_writer_init(run_writer *const w, FILE *const file, const run_format format)
+{
+    w->file = file;
+    w->format = format;
+    w->prev = 0;
+    w->count = 0;
+}
+
+void run_write(run_writer *const w, const int number)
+{
+    if (w->format == RUN_FORMAT_DELTA) {
+        write_varint(w->file, zigzag_encode((int64_t) number - w->prev));
+        w->prev = number;
+    } else {
+        fprintf(w->file, w->count == 0 ? "%d" : " %d", number);
+    }
+    w->count++;
+}
+
+void run_writer_finish(run_writer *const w)
+{
+    fflush(w->file);
+}
+
+void run_reader_init(run_reader *const r, FILE *const file, const run_format format)
+{
+    r->file = file;
+    r->format = format;
+    r->prev = 0;
+    r->remaining = INT64_MAX;
+}
+
+void run_reader_limit(run_reader *const r, const int64_t len)
+{
+    r->remaining = len;
+}
+
+static bool read_text(run_reader *const r, int *const number)
+{
+    int ch;
+    do {
+        if (r->remaining <= 0) {
+            return false;
+        }
+        ch = getc_unlocked(r->file);
+        r->remaining--;
+    } while (isspace(ch));
+    if (ch == EOF) {
+        r->remaining = 0;
+        return false;
+    }
+
+    bool negative = ch == '-';
+    if (ch == '-' || ch == '+') {
+        ch = getc_unlocked(r->file);
+        r->remaining--;
+    }
+    int64_t value = 0;
+    while (ch >= '0' && ch <= '9') {
+        value = value * 10 + (ch - '0');
+        ch = getc_unlocked(r->file);
+        r->remaining--;
+    }
+    // Separator after the number is consumed too, so remaining may become negative
+    if (ch == EOF) {
+        r->remaining = 0;
+    }
+
+    *number = (int) (negative ? -value : value);
+    return true;
+}
+
+bool run_read(run_reader *const r, int *const number)
+{
+    if (r->format == RUN_FORMAT_DELTA) {
+        uint64_t encoded;
+        if (!read_varint(r->file, &encoded)) {
+            return false;
+        }
+        r->prev = (int) (r->prev + zigzag_decode(encoded));
+        *number = r->prev;
+        return true;
+    }
+    return read_text(r, number);
+}
+
+size_t run_count(FILE *const file, const run_format format)
+{
+    size_t output = 0;
+    if (format == RUN_FORMAT_DELTA) {
+        // Every varint ends with exactly one byte without continuation bit
+        int byte;
+        while ((byte = getc_unlocked(file)) != EOF) {
+            if ((byte & VARINT_CONTINUATION) == 0) {
+                output++;
+            }
+        }
+    } else {
+        run_reader r;
+        int tmp;
+        run_reader_init(&r, file, format);
+        while (run_read(&r, &tmp)) {
+            output++;
+        }
+    }
+    rewind(file);
+    return output;
+}
@@ -0,0 +1,46 @@
+#ifndef ASSIGNMENT_1_LIBRUN_H
+#define ASSIGNMENT_1_LIBRUN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Format of the sorted runs spilled to temporary files.
+// TEXT is the same format as input files: numbers separated with spaces.
+// DELTA stores each number as a zigzag varint of its difference with the previous one.
+// Sorted runs have small non-negative deltas, so most numbers take 1-3 bytes instead of 8-11.
+typedef enum {
+    RUN_FORMAT_TEXT,
+    RUN_FORMAT_DELTA,
+} run_format;
+
+typedef struct {
+    FILE *file;
+    run_format format;
+    int prev;
+    size_t count;
+} run_writer;
+
+typedef struct {
+    FILE *file;
+    run_format format;
+    int prev;
+    // Bytes left to read, only text runs are limited
+    int64_t remaining;
+} run_reader;
+
+void run_set_spill_format(run_format format);
+run_format run_get_spill_format();
+
+void run_writer_init(run_writer *const w, FILE *const file, const run_format format);
+void run_write(run_writer *const w, const int number);
+void run_writer_finish(run_writer *const w);
+
+void run_reader_init(run_reader *const r, FILE *const file, const run_format format);
+// Makes text reader stop at the first number which starts after len bytes from the current position
+void run_reader_limit(run_reader *const r, const int64_t len);
+bool run_read(run_reader *const r, int *const number);
+
+size_t run_count(FILE *const file, const run_format format);
+
+#endif //ASSIGNMENT_1_LIBRUN_H
@@ -0,0 +1,157 @@
+#include <limits.h>
+#include <string.h>
+
+#include "libsmallsort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SMALL_SORT_HAS_AVX2
+#include <immintrin.h>
+#endif
+
+#define LANES 8
+#define REGISTERS (SMALL_SORT_MAX / LANES)
+
+typedef void (*small_sort_f)(int *const numbers, const size_t len);
+
+static void small_sort_scalar(int *const numbers, const size_t len)
+{
+    for (size_t i = 1; i < len; i++) {
+        int value = numbers[i];
+        size_t j = i;
+        while (j > 0 && numbers[j - 1] > value) {
+            numbers[j] = numbers[j - 1];
+            j--;
+        }
+        numbers[j] = value;
+    }
+}
+
+#ifdef SMALL_SORT_HAS_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline void compare_swap(__m256i *const a, __m256i *const b)
+{
+    __m256i min = _mm256_min_epi32(*a, *b);
+    *b = _mm256_max_epi32(*a, *b);
+    *a = min;
+}
+
+/* Sorts a bitonic sequence of 8 numbers within a register: half-cleaners with lane distances 4, 2 and 1. */
+AVX2_TARGET static inline __m256i bitonic_clean(__m256i v)
+{
+    __m256i p = _mm256_permute2x128_si256(v, v, 1);
+    v = _mm256_blend_epi32(_mm256_min_epi32(v, p), _mm256_max_epi32(v, p), 0xF0);
+    p = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    v = _mm256_blend_epi32(_mm256_min_epi32(v, p), _mm256_max_epi32(v, p), 0xCC);
+    p = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm256_blend_epi32(_mm256_min_epi32(v, p), _mm256_max_epi32(v, p), 0xAA);
+    return v;
+}
+
+/* Merges two sorted sequences r[0..k) and r[k..2k) of registers into one sorted sequence r[0..2k). */
+AVX2_TARGET static inline void merge_registers(__m256i *const r, const size_t k)
+{
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (size_t i = 0; i < k / 2; i++) {
+        __m256i temp = r[k + i];
+        r[k + i] = r[2 * k - 1 - i];
+        r[2 * k - 1 - i] = temp;
+    }
+    for (size_t i = k; i < 2 * k; i++) {
+        r[i] = _mm256_permutevar8x32_epi32(r[i], reverse);
+    }
+
+    // Now r[0..2k) is bitonic
+    for (size_t d = k; d > 0; d /= 2) {
+        for (size_t block = 0; block < 2 * k; block += 2 * d) {
+            for (size_t i = block; i < block + d; i++) {
+                compare_swap(&r[i], &r[i + d]);
+            }
+        }
+    }
+    for (size_t i = 0; i < 2 * k; i++) {
+        r[i] = bitonic_clean(r[i]);
+    }
+}
+
+AVX2_TARGET static inline void transpose(__m256i *const r)
+{
+    __m256i t[REGISTERS], u[REGISTERS];
+    for (size_t i = 0; i < REGISTERS; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (size_t i = 0; i < REGISTERS; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (size_t i = 0; i < REGISTERS / 2; i++) {
+        r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+/*
+ * Sorts 64 numbers in 8 registers: optimal 8-input sorting network sorts columns, transposition turns them
+ * into 8 sorted rows, and the rows are merged by bitonic merges 8+8, 16+16 and 32+32.
+ * Shorter input is padded with INT_MAX, which sinks to the end and is not stored back.
+ */
+AVX2_TARGET static void small_sort_avx2(int *const numbers, const size_t len)
+{
+    static const size_t network[][2] = {
+            {0, 2}, {1, 3}, {4, 6}, {5, 7},
+            {0, 4}, {1, 5}, {2, 6}, {3, 7},
+            {0, 1}, {2, 3}, {4, 5}, {6, 7},
+            {2, 4}, {3, 5},
+            {1, 4}, {3, 6},
+            {1, 2}, {3, 4}, {5, 6},
+    };
+
+    int buf[SMALL_SORT_MAX];
+    memcpy(buf, numbers, len * sizeof(int));
+    for (size_t i = len; i < SMALL_SORT_MAX; i++) {
+        buf[i] = INT_MAX;
+    }
+
+    __m256i r[REGISTERS];
+    for (size_t i = 0; i < REGISTERS; i++) {
+        r[i] = _mm256_loadu_si256((const __m256i *) &buf[i * LANES]);
+    }
+    for (size_t i = 0; i < sizeof(network) / sizeof(network[0]); i++) {
+        compare_swap(&r[network[i][0]], &r[network[i][1]]);
+    }
+    transpose(r);
+    for (size_t k = 1; k < REGISTERS; k *= 2) {
+        for (size_t i = 0; i < REGISTERS; i += 2 * k) {
+            merge_registers(&r[i], k);
+        }
+    }
+    for (size_t i = 0; i < REGISTERS; i++) {
+        _mm256_storeu_si256((__m256i *) &buf[i * LANES], r[i]);
+    }
+
+    memcpy(numbers, buf, len * sizeof(int));
+}
+#endif
+
+static small_sort_f select_small_sort()
+{
+#ifdef SMALL_SORT_HAS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return small_sort_avx2;
+    }
+#endif
+    return small_sort_scalar;
+}
+
+void small_sort(int *const numbers, const size_t len)
+{
+    static small_sort_f impl = NULL;
+    if (impl == NULL) {
+        impl = select_small_sort();
+    }
+    impl(numbers, len);
+}
@@ -0,0 +1,12 @@
+#ifndef ASSIGNMENT_1_LIBSMALLSORT_H
+#define ASSIGNMENT_1_LIBSMALLSORT_H
+
+#include <stddef.h>
+
+// Partitions of at most this size are sorted by small_sort() instead of further partitioning
+#define SMALL_SORT_MAX 64
+
+// Sorts up to SMALL_SORT_MAX numbers. Uses AVX2 sorting network if CPU supports it, insertion sort otherwise.
+void small_sort(int *const numbers, const size_t len);
+
+#endif //ASSIGNMENT_1_LIBSMALLSORT_H
@@ -5,47 +5,12 @@
 #include <assert.h>
 
 #include "libsort.h"
+#include "librun.h"
+#include "libsmallsort.h"
 #include "libutil.h"
 
 #define printf(...)
 
-static size_t split_range(const size_t start, const size_t end)
-{
-    return start + (end - start) / 2;
-}
-
-static size_t calculate_left_interval(const size_t start, const size_t mid, const size_t end)
-{
-    return mid - start + 1;
-}
-
-static size_t calculate_right_interval(const size_t start, const size_t mid, const size_t end)
-{
-    return end - mid;
-}
-
-static void transfer_numbers(FILE * const from, FILE * const to, const size_t len)
-{
-    int tmp;
-    for (size_t i = 0; i < len - 1; i++) {
-        fscanf(from, "%d", &tmp);
-        fprintf(to, "%d ", tmp);
-    }
-    fscanf(from, "%d", &tmp);
-    fprintf(to, "%d", tmp);
-    fflush(to);
-}
-
-static void print_numbers(FILE * const file, const size_t len)
-{
-    int tmp;
-    for (size_t i = 0; i < len; i++) {
-        fscanf(file, "%d", &tmp);
-        printf("%d ", tmp);
-    }
-    printf("\n");
-}
-
 // ASSUMPTION: There are no more than 10000 list sorting procedures.
 // If it was prod code, I would like to use map trace_id -> {target_latency, timestamp} with erasure at end of sorting
 // But it is edu purposes code, so I would like omit it to save time (I wrote it in 3:40 PM :D)
@@ -68,202 +33,432 @@ do {                                                                           \
     }                                                                          \
 } while(0);
 
-static FILE *merge_files(const int trace_id, FILE *const file_left, FILE *const file_right,
-                         size_t left_len, size_t right_len)
+static void swap_numbers(int *const numbers, const size_t a, const size_t b)
 {
-    FILE *output = tmpfile();
-    if (file_left == NULL && file_right == NULL) {
-        printf("[RUN %d][MERGE] Both parts are empty.\n", trace_id);
-        goto EXIT;
-    }
-    if (file_left == NULL) {
-        printf("[RUN %d][MERGE] Left part is empty, right part (len=%lu):\n", trace_id, right_len);
-        print_numbers(file_right, right_len); rewind(file_right);
-        transfer_numbers(file_right, output, right_len);
-        goto EXIT;
-    }
-    if (file_right == NULL) {
-        printf("[RUN %d][MERGE] Right part is empty, left part (len=%lu):\n", trace_id, left_len);
-        print_numbers(file_left, left_len); rewind(file_left);
-        transfer_numbers(file_left, output, left_len);
-        goto EXIT;
-    }
+    int temp = numbers[a];
+    numbers[a] = numbers[b];
+    numbers[b] = temp;
+}
 
-    printf("[RUN %d][MERGE] Left part (len=%lu):  ", trace_id, left_len);
-    print_numbers(file_left, left_len);
-    printf("[RUN %d] MERGE] Right part (len=%lu): ", trace_id, right_len);
-    print_numbers(file_right, right_len);
-    rewind(file_left);
-    rewind(file_right);
-
-    int left_num, right_num;
-    fscanf(file_left, "%d", &left_num);
-    fscanf(file_right, "%d", &right_num);
-
-    size_t left_cnt = 0, right_cnt = 0;
-    while (left_cnt < left_len || right_cnt < right_len) {
-        int to_print = 0;
-
-        if (left_cnt == left_len && right_cnt < right_len) {
-            to_print = right_num;
-            fscanf(file_right, "%d", &right_num);
-            right_cnt++;
-        } else if (right_cnt == right_len && left_cnt < left_len) {
-            to_print = left_num;
-            fscanf(file_left, "%d", &left_num);
-            left_cnt++;
-        } else if (left_num <= right_num && left_cnt < left_len) {
-            to_print = left_num;
-            fscanf(file_left, "%d", &left_num);
-            left_cnt++;
-        } else if (left_num > right_num && right_cnt < right_len) {
-            to_print = right_num;
-            fscanf(file_right, "%d", &right_num);
-            right_cnt++;
+/*
+ * Median of three is the pivot, so sorted and reverse-sorted ranges split in halves. Both scans stop at numbers
+ * equal to the pivot, so do runs of duplicates. The smaller part is sorted recursively and the larger one
+ * by the loop, which keeps the depth of recursion logarithmic.
+ */
+static void quick_sort(const int trace_id, size_t *const ctx_switch_count,
+                       int * const numbers, size_t first, size_t last)
+{
+    while (first < last) {
+        if (last - first < SMALL_SORT_MAX) {
+            small_sort(&numbers[first], last - first + 1);
+            return;
         }
 
-        if (left_cnt == left_len && right_cnt == right_len) {
-            fprintf(output, "%d", to_print);
+        size_t middle = first + (last - first) / 2;
+        if (numbers[middle] < numbers[first])
+            swap_numbers(numbers, first, middle);
+        if (numbers[last] < numbers[first])
+            swap_numbers(numbers, first, last);
+        if (numbers[last] < numbers[middle])
+            swap_numbers(numbers, middle, last);
+        int pivot = numbers[middle];
+
+        size_t i = first;
+        size_t j = last;
+        while (true) {
+            while (numbers[i] < pivot)
+                i++;
+            while (numbers[j] > pivot)
+                j--;
+            if (i >= j)
+                break;
+            swap_numbers(numbers, i, j);
+            i++;
+            j--;
+        }
+
+        YIELD();
+
+        if (j - first < last - j) {
+            quick_sort(trace_id, ctx_switch_count, numbers, first, j);
+            first = j + 1;
         } else {
-            fprintf(output, "%d ", to_print);
+            quick_sort(trace_id, ctx_switch_count, numbers, j + 1, last);
+            last = j;
         }
     }
-
-    EXIT:
-    fflush(output);
-    rewind(output);
-    return output;
 }
 
-static FILE *merge(const int trace_id, FILE *file_left, FILE *file_right, size_t start, size_t mid, size_t end)
+static void reverse_numbers(int *const numbers, size_t first, size_t last)
 {
-    size_t left_len  = calculate_left_interval(start, mid, end);
-    size_t right_len = calculate_right_interval(start, mid, end);
-
-    return merge_files(trace_id, file_left, file_right, left_len, right_len);
+    while (first < last) {
+        swap_numbers(numbers, first, last);
+        first++;
+        last--;
+    }
 }
 
-static void quick_sort(const int trace_id, size_t *const ctx_switch_count,
-                       int * const numbers, const size_t first, const size_t last)
+/*
+ * Timsort-like run detection: descending runs are reversed in place, so the chunk becomes a sequence of ascending
+ * runs. Equal numbers can't be told apart, so a descending run may have them too. Returns the number of these runs.
+ */
+static size_t prepare_natural_runs(int *const numbers, const size_t len)
 {
-    int temp;
-    size_t pivot, i, j;
-    if (first >= last) {
-        return;
+    size_t runs = 0;
+    size_t start = 0;
+    while (start < len) {
+        size_t end = start + 1;
+        while (end < len && numbers[end] == numbers[start])
+            end++;
+        if (end < len && numbers[end] < numbers[end - 1]) {
+            while (end < len && numbers[end] <= numbers[end - 1])
+                end++;
+            reverse_numbers(numbers, start, end - 1);
+        } else {
+            while (end < len && numbers[end] >= numbers[end - 1])
+                end++;
+        }
+
+        if (start == 0 || numbers[start] < numbers[start - 1]) {
+            runs++;
+        }
+        start = end;
     }
+    return runs;
+}
 
-    pivot = first;
-    i = first;
-    j = last;
+typedef struct {
+    size_t start;
+    size_t len;
+} natural_run;
 
-    while (i < j){
-        while (numbers[i] <= numbers[pivot] && i < last)
-            i++;
+// Enough for runs of 2^64 numbers with the Timsort invariants
+#define RUN_STACK_SIZE 96
 
-        while (numbers[j] > numbers[pivot])
-            j--;
+/* Minimal run length of Timsort: between 32 and 64, such that len / min_run is close to a power of two. */
+static size_t min_run_len(size_t len)
+{
+    size_t low_bits = 0;
+    while (len >= 64) {
+        low_bits |= len & 1;
+        len >>= 1;
+    }
+    return len + low_bits;
+}
 
-        if (i < j){
-            temp = numbers[i];
-            numbers[i] = numbers[j];
-            numbers[j] = temp;
+/* Sorts len numbers with insertion sort, the first sorted numbers are already in order. */
+static void extend_run(int *const numbers, const size_t len, size_t sorted)
+{
+    for (; sorted < len; sorted++) {
+        int value = numbers[sorted];
+        size_t low = 0;
+        size_t high = sorted;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (numbers[mid] <= value)
+                low = mid + 1;
+            else
+                high = mid;
         }
+        memmove(&numbers[low + 1], &numbers[low], (sorted - low) * sizeof(int));
+        numbers[low] = value;
     }
+}
 
-    temp = numbers[pivot];
-    numbers[pivot] = numbers[j];
-    numbers[j] = temp;
+/* Index of the first number greater than value in the sorted numbers, or of the first one not less if strict. */
+static size_t bound_of(const int *const numbers, const size_t len, const int value, const bool strict)
+{
+    size_t low = 0;
+    size_t high = len;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strict ? numbers[mid] < value : numbers[mid] <= value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
 
-    YIELD();
+/*
+ * Merges two adjacent ascending runs. Numbers of the left one not greater than the first one of the right run
+ * and numbers of the right one not less than the last one of the left run are in place already; the shorter of
+ * what is left goes to the buffer, so it needs half of the numbers at most.
+ */
+static void merge_adjacent(int *const numbers, int *const buffer, size_t left_len, size_t right_len)
+{
+    int *left = numbers;
+    int *right = numbers + left_len;
+    size_t skip = bound_of(left, left_len, right[0], false);
+    left += skip;
+    left_len -= skip;
+    if (left_len == 0)
+        return;
+    right_len = bound_of(right, right_len, left[left_len - 1], true);
 
-    if (j != 0) {
-        quick_sort(trace_id, ctx_switch_count, numbers, first, j - 1);
+    if (left_len <= right_len) {
+        memcpy(buffer, left, left_len * sizeof(int));
+        size_t i = 0, j = 0, k = 0;
+        while (i < left_len && j < right_len) {
+            left[k++] = buffer[i] <= right[j] ? buffer[i++] : right[j++];
+        }
+        memcpy(&left[k], &buffer[i], (left_len - i) * sizeof(int));
+    } else {
+        memcpy(buffer, right, right_len * sizeof(int));
+        size_t i = left_len, j = right_len, k = left_len + right_len;
+        while (i > 0 && j > 0) {
+            left[--k] = left[i - 1] > buffer[j - 1] ? left[--i] : buffer[--j];
+        }
+        memcpy(left, buffer, j * sizeof(int));
     }
-    quick_sort(trace_id, ctx_switch_count, numbers, j + 1, last);
 }
 
-static FILE *quick_sort_prepare(const int trace_id, size_t *const ctx_switch_count, FILE *const input, const size_t len)
+/* Merges runs at top of the stack while the Timsort invariants don't hold, or all of them if forced. */
+static size_t collapse_runs(int *const numbers, int *const buffer, natural_run *const stack, size_t height,
+                            const bool force)
 {
-    printf("[RUN %d][QUICK_SORT] Sorting %lu numbers using quick-sort\n", trace_id, len);
-    int *numbers = (int *) calloc(len, sizeof(int));
-    for (size_t i = 0; i < len; i++) {
-        fscanf(input, "%d", &numbers[i]);
+    while (height > 1) {
+        size_t n = height - 2;
+        if (force) {
+            if (n > 0 && stack[n - 1].len < stack[n + 1].len)
+                n--;
+        } else if ((n > 0 && stack[n - 1].len <= stack[n].len + stack[n + 1].len) ||
+                   (n > 1 && stack[n - 2].len <= stack[n - 1].len + stack[n].len)) {
+            if (stack[n - 1].len < stack[n + 1].len)
+                n--;
+        } else if (stack[n].len > stack[n + 1].len) {
+            break;
+        }
+
+        merge_adjacent(&numbers[stack[n].start], buffer, stack[n].len, stack[n + 1].len);
+        stack[n].len += stack[n + 1].len;
+        for (size_t i = n + 1; i + 1 < height; i++) {
+            stack[i] = stack[i + 1];
+        }
+        height--;
     }
+    return height;
+}
 
-    quick_sort(trace_id, ctx_switch_count, numbers, 0, len - 1);
+/*
+ * Sorts a chunk of ascending natural runs like Timsort: short runs are extended to the minimal run length
+ * with insertion sort, then runs are merged while balanced, so a chunk of a few long runs takes a linear pass.
+ */
+static void merge_natural_runs(const int trace_id, size_t *const ctx_switch_count, int *const numbers,
+                               int *const buffer, const size_t len)
+{
+    natural_run stack[RUN_STACK_SIZE];
+    size_t height = 0;
+    size_t min_run = min_run_len(len);
+    size_t start = 0;
+    while (start < len) {
+        size_t end = start + 1;
+        while (end < len && numbers[end] >= numbers[end - 1])
+            end++;
+        if (end - start < min_run) {
+            size_t forced = len - start < min_run ? len : start + min_run;
+            extend_run(&numbers[start], forced - start, end - start);
+            end = forced;
+        }
 
-    FILE *output = tmpfile();
-    for (size_t i = 0; i < len - 1; i++) {
-        fprintf(output, "%d ", numbers[i]);
+        stack[height].start = start;
+        stack[height].len = end - start;
+        height = collapse_runs(numbers, buffer, stack, height + 1, false);
+        start = end;
+        YIELD();
     }
-    fprintf(output, "%d", numbers[len - 1]);
+    collapse_runs(numbers, buffer, stack, height, true);
+}
 
-    free(numbers);
-    return output;
+typedef struct {
+    FILE *file;
+    size_t len;
+    // How many times numbers of this run were merged, used to keep amount of opened runs logarithmic
+    unsigned level;
+} sorted_run;
+
+#define INITIAL_RUNS_CAPACITY 8
+// Numbers read at once: the rest of MAX_NUMBERS_LOADED is the buffer for merging natural runs of the chunk
+#define CHUNK_LEN (MAX_NUMBERS_LOADED / 3 * 2)
+// Chunks with shorter natural runs on average are sorted with quick-sort, others by merging their runs
+#define MIN_NATURAL_RUN_LEN 32
+// How many runs are merged in one pass
+#define MERGE_FAN_IN 16
+// How many numbers are merged between yields
+#define MERGE_YIELD_PERIOD 4096
+
+static void sift_down(size_t *const heap, const size_t size, const int *const heads, size_t i)
+{
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = 2 * i + 2;
+        if (left < size && heads[heap[left]] < heads[heap[smallest]])
+            smallest = left;
+        if (right < size && heads[heap[right]] < heads[heap[smallest]])
+            smallest = right;
+        if (smallest == i)
+            return;
+
+        size_t temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
 }
 
-static FILE *split(const int trace_id, size_t *const ctx_switch_count,
-                   FILE *const input, const size_t start, const size_t end) {
-    printf("[RUN %d][MERGE_SORT] Sorting from %lu to %lu numbers using merge-sort\n", trace_id, start, end);
-    if (end - start == 0) {
-        FILE *output = tmpfile();
-        transfer_numbers(input, output, 1);
-        rewind(output);
-        return output;
+/* Merges runs into a single one in one pass using min-heap of their current numbers. Input runs are closed. */
+static sorted_run merge_group(const int trace_id, size_t *const ctx_switch_count, sorted_run *const runs,
+                              const size_t count)
+{
+    run_reader *readers = (run_reader *) calloc(count, sizeof(run_reader));
+    int *heads = (int *) calloc(count, sizeof(int));
+    size_t *heap = (size_t *) calloc(count, sizeof(size_t));
+    size_t heap_size = 0;
+
+    sorted_run output = {.file = tmpfile(), .len = 0, .level = 0};
+    for (size_t i = 0; i < count; i++) {
+        rewind(runs[i].file);
+        run_reader_init(&readers[i], runs[i].file, run_get_spill_format());
+        if (run_read(&readers[i], &heads[i])) {
+            heap[heap_size++] = i;
+        }
+        output.len += runs[i].len;
+        if (runs[i].level + 1 > output.level) {
+            output.level = runs[i].level + 1;
+        }
+    }
+    for (size_t i = heap_size / 2; i-- > 0;) {
+        sift_down(heap, heap_size, heads, i);
     }
 
-    size_t mid = split_range(start, end - 1);
-    size_t left_len  = calculate_left_interval(start, mid, end - 1);
-    size_t right_len = calculate_right_interval(start, mid, end - 1);
+    run_writer writer;
+    run_writer_init(&writer, output.file, run_get_spill_format());
+    size_t written = 0;
+    while (heap_size > 0) {
+        size_t top = heap[0];
+        run_write(&writer, heads[top]);
+        if (!run_read(&readers[top], &heads[top])) {
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(heap, heap_size, heads, 0);
 
-    FILE *left = tmpfile();
-    FILE *right = tmpfile();
+        if (++written % MERGE_YIELD_PERIOD == 0) {
+            YIELD();
+        }
+    }
+    run_writer_finish(&writer);
+    printf("[RUN %d][MERGE] Merged %lu runs into %lu numbers\n", trace_id, count, output.len);
 
-    transfer_numbers(input, left, left_len);
-    transfer_numbers(input, right, right_len);
-    rewind(left); rewind(right);
+    for (size_t i = 0; i < count; i++) {
+        fclose(runs[i].file);
+    }
+    free(heap);
+    free(heads);
+    free(readers);
+    return output;
+}
 
-    printf("From %lu to %lu, mid=%lu, left_len=%lu, right_len=%lu\n", start, end, mid, left_len, right_len);
-    FILE *left_output = left_len > MAX_NUMBERS_LOADED ?
-                        split(trace_id, ctx_switch_count, left, start, mid) :
-                        quick_sort_prepare(trace_id, ctx_switch_count, left, left_len);
-    YIELD();
-    FILE *right_output = right_len > MAX_NUMBERS_LOADED ?
-                         split(trace_id, ctx_switch_count, right, mid + 1, end) :
-                         quick_sort_prepare(trace_id, ctx_switch_count, right, right_len);
-    YIELD();
+/* Merges the newest MERGE_FAN_IN finished runs while they are of the same level (tiered compaction). */
+static size_t compact_runs(const int trace_id, size_t *const ctx_switch_count, sorted_run *const runs,
+                           size_t count)
+{
+    while (count >= MERGE_FAN_IN && runs[count - MERGE_FAN_IN].level == runs[count - 1].level) {
+        sorted_run merged = merge_group(trace_id, ctx_switch_count, &runs[count - MERGE_FAN_IN], MERGE_FAN_IN);
+        count -= MERGE_FAN_IN;
+        runs[count++] = merged;
+    }
+    return count;
+}
 
-    fclose(left); fclose(right);
-    if (left_output != NULL) rewind(left_output);
-    if (right_output != NULL) rewind(right_output);
+/*
+ * Reads input by chunks of CHUNK_LEN numbers and spills every chunk sorted. A chunk made of long natural runs is
+ * sorted by merging them, others with quick-sort. A chunk which continues the previous one is appended to its run
+ * instead of starting a new one, so sorted and nearly sorted input produce a single run.
+ */
+static size_t generate_runs(const int trace_id, size_t *const ctx_switch_count, run_reader *const input,
+                            sorted_run **const runs_out)
+{
+    int *numbers = (int *) calloc(MAX_NUMBERS_LOADED, sizeof(int));
+    size_t runs_capacity = INITIAL_RUNS_CAPACITY;
+    size_t runs_count = 0;
+    sorted_run *runs = (sorted_run *) calloc(runs_capacity, sizeof(sorted_run));
+
+    run_writer writer;
+    int last = 0;
+    size_t len;
+    do {
+        len = 0;
+        while (len < CHUNK_LEN && run_read(input, &numbers[len])) {
+            len++;
+        }
+        if (len == 0) {
+            break;
+        }
 
-    FILE *merged_output = merge(trace_id, left_output, right_output, start, mid, end - 1);
-    printf("[RUN %d][SPLIT] Result of merge: ", trace_id);
-    print_numbers(merged_output, end - start + 1);
-    fclose(left_output); fclose(right_output);
-    YIELD();
+        size_t natural_runs = prepare_natural_runs(numbers, len);
+        if (len / natural_runs < MIN_NATURAL_RUN_LEN) {
+            printf("[RUN %d][QUICK_SORT] Sorting %lu numbers using quick-sort\n", trace_id, len);
+            quick_sort(trace_id, ctx_switch_count, numbers, 0, len - 1);
+        } else if (natural_runs > 1) {
+            printf("[RUN %d][MERGE] Merging %lu natural runs of %lu numbers\n", trace_id, natural_runs, len);
+            merge_natural_runs(trace_id, ctx_switch_count, numbers, numbers + CHUNK_LEN, len);
+        }
+        YIELD();
+
+        for (size_t i = 0; i < len; i++) {
+            if (runs_count == 0 || numbers[i] < last) {
+                if (runs_count > 0) {
+                    run_writer_finish(&writer);
+                    runs_count = compact_runs(trace_id, ctx_switch_count, runs, runs_count);
+                }
+                if (runs_count == runs_capacity) {
+                    runs_capacity *= 2;
+                    runs = (sorted_run *) realloc(runs, runs_capacity * sizeof(sorted_run));
+                }
+                runs[runs_count].file = tmpfile();
+                runs[runs_count].len = 0;
+                runs[runs_count].level = 0;
+                run_writer_init(&writer, runs[runs_count].file, run_get_spill_format());
+                runs_count++;
+            }
+            run_write(&writer, numbers[i]);
+            runs[runs_count - 1].len++;
+            last = numbers[i];
+        }
+    } while (len == CHUNK_LEN);
+
+    if (runs_count > 0) {
+        run_writer_finish(&writer);
+    }
+    printf("[RUN %d] Generated %lu runs\n", trace_id, runs_count);
 
-    rewind(merged_output);
-    return merged_output;
+    free(numbers);
+    *runs_out = runs;
+    return runs_count;
 }
 
-size_t count_numbers_in_file(FILE * const file)
+static FILE *merge_runs(const int trace_id, size_t *const ctx_switch_count, sorted_run *const runs, size_t count)
 {
-    size_t output = 0;
-    char symbol = 0;
-    while (symbol != EOF) {
-        symbol = (char) fgetc(file);
-        if (symbol == ' ' || symbol == '\n' || symbol == '\0' || symbol == EOF) {
-            output++;
+    if (count == 0) {
+        return tmpfile();
+    }
+
+    while (count > 1) {
+        size_t merged = 0;
+        for (size_t i = 0; i < count; i += MERGE_FAN_IN) {
+            size_t group = count - i < MERGE_FAN_IN ? count - i : MERGE_FAN_IN;
+            runs[merged++] = group > 1 ? merge_group(trace_id, ctx_switch_count, &runs[i], group) : runs[i];
         }
-    };
-    rewind(file);
-    return output;
+        count = merged;
+    }
+    rewind(runs[0].file);
+    return runs[0].file;
 }
 
 static int trace_id = 0;
-FILE *sort_file(const uint64_t latency, const char *const name, size_t *const ctx_switch_count,
-                uint64_t *const execTime)
+FILE *sort_file(const uint64_t latency, const char *const name, const uint64_t offset, const uint64_t len,
+                size_t *const ctx_switch_count, uint64_t *const execTime)
 {
     trace_id++;
     int cur_trace_id = trace_id;
@@ -276,14 +471,14 @@ FILE *sort_file(const uint64_t latency, const char *const name, size_t *const ct
         return NULL;
     }
 
-    size_t numbers_in_file = count_numbers_in_file(file);
-    printf("[RUN %d] Numbers in file: %lu\n", cur_trace_id, numbers_in_file);
-    rewind(file);
-    FILE *output = numbers_in_file > MAX_NUMBERS_LOADED ?
-            split(cur_trace_id, ctx_switch_count, file, 0, numbers_in_file) :
-                  quick_sort_prepare(trace_id, ctx_switch_count, file, numbers_in_file);
-    printf("[RUN %d] Result of sort: ", cur_trace_id);
-    print_numbers(output, numbers_in_file);
+    fseek(file, (long) offset, SEEK_SET);
+    run_reader input;
+    run_reader_init(&input, file, RUN_FORMAT_TEXT);
+    run_reader_limit(&input, (int64_t) len);
+    sorted_run *runs = NULL;
+    size_t runs_count = generate_runs(cur_trace_id, ctx_switch_count, &input, &runs);
+    FILE *output = merge_runs(cur_trace_id, ctx_switch_count, runs, runs_count);
+    free(runs);
     fclose(file);
     rewind(output);
     YIELD();
@@ -291,12 +486,3 @@ FILE *sort_file(const uint64_t latency, const char *const name, size_t *const ct
     return output;
 }
 
-/* This function doesn't require yield! */
-FILE *merge_sorted_files(FILE *const a, FILE *const b)
-{
-    trace_id++;
-
-    size_t a_len = count_numbers_in_file(a);
-    size_t b_len = count_numbers_in_file(b);
-    return merge_files(trace_id, a, b, a_len, b_len);
-}
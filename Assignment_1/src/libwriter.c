@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libwriter.h"
+
+// Must be a multiple of the block size to be written with O_DIRECT
+#define WRITER_BUFFER_SIZE (1 << 20)
+#define WRITER_ALIGNMENT 4096
+
+struct output_writer {
+    int fd;
+    int flags;
+    size_t written;
+
+    char *buffers[2];
+    size_t active;
+    size_t used;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* Buffer handed to the writer thread, NULL if it is idle. */
+    char *pending;
+    size_t pending_len;
+    bool closing;
+    int error;
+};
+
+static int write_all(const int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t res = write(fd, data, len);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        data += res;
+        len -= res;
+    }
+    return 0;
+}
+
+static void *writer_thread_f(void *context)
+{
+    output_writer *const w = (output_writer *) context;
+    pthread_mutex_lock(&w->lock);
+    while (true) {
+        while (w->pending == NULL && !w->closing) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->pending == NULL) {
+            break;
+        }
+
+        char *data = w->pending;
+        size_t len = w->pending_len;
+        pthread_mutex_unlock(&w->lock);
+        int error = write_all(w->fd, data, len);
+        pthread_mutex_lock(&w->lock);
+
+        if (error != 0 && w->error == 0) {
+            w->error = error;
+        }
+        w->written += len;
+        w->pending = NULL;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Waits until the writer thread is idle, so both buffers may be used by the caller. */
+static void wait_pending(output_writer *const w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->pending != NULL) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void submit_active(output_writer *const w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->pending != NULL) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    w->pending = w->buffers[w->active];
+    w->pending_len = w->used;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    w->active ^= 1;
+    w->used = 0;
+}
+
+static void write_bytes(output_writer *const w, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t chunk = WRITER_BUFFER_SIZE - w->used;
+        if (chunk > len)
+            chunk = len;
+        memcpy(w->buffers[w->active] + w->used, data, chunk);
+        w->used += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (w->used == WRITER_BUFFER_SIZE) {
+            submit_active(w);
+        }
+    }
+}
+
+output_writer *output_writer_open(const char *const name, const int flags, const size_t size_hint)
+{
+    output_writer *w = (output_writer *) calloc(1, sizeof(output_writer));
+    w->flags = flags;
+
+    int open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    w->fd = -1;
+    if (flags & OUTPUT_WRITER_DIRECT) {
+        w->fd = open(name, open_flags | O_DIRECT, 0644);
+        if (w->fd < 0) {
+            w->flags &= ~OUTPUT_WRITER_DIRECT;
+        }
+    }
+    if (w->fd < 0) {
+        w->fd = open(name, open_flags, 0644);
+    }
+    if (w->fd < 0) {
+        printf("Failed to open %s: %s\n", name, strerror(errno));
+        free(w);
+        return NULL;
+    }
+
+    if ((flags & OUTPUT_WRITER_PREALLOCATE) && size_hint > 0) {
+        int error = posix_fallocate(w->fd, 0, (off_t) size_hint);
+        if (error != 0) {
+            printf("Failed to preallocate %lu bytes: %s\n", size_hint, strerror(error));
+        }
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+        if (posix_memalign((void **) &w->buffers[i], WRITER_ALIGNMENT, WRITER_BUFFER_SIZE) != 0) {
+            printf("Failed to allocate output buffer\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    pthread_create(&w->thread, NULL, writer_thread_f, w);
+    return w;
+}
+
+void output_writer_write_number(output_writer *const w, const int number)
+{
+    char text[OUTPUT_WRITER_MAX_NUMBER_LEN];
+    size_t pos = OUTPUT_WRITER_MAX_NUMBER_LEN;
+    text[--pos] = ' ';
+
+    unsigned value = number < 0 ? 0u - (unsigned) number : (unsigned) number;
+    do {
+        text[--pos] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (number < 0) {
+        text[--pos] = '-';
+    }
+
+    if (w->used + OUTPUT_WRITER_MAX_NUMBER_LEN - pos < WRITER_BUFFER_SIZE) {
+        memcpy(w->buffers[w->active] + w->used, text + pos, OUTPUT_WRITER_MAX_NUMBER_LEN - pos);
+        w->used += OUTPUT_WRITER_MAX_NUMBER_LEN - pos;
+    } else {
+        write_bytes(w, text + pos, OUTPUT_WRITER_MAX_NUMBER_LEN - pos);
+    }
+}
+
+int output_writer_close(output_writer *const w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->closing = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    wait_pending(w);
+    pthread_join(w->thread, NULL);
+
+    int error = w->error;
+    const char *tail = w->buffers[w->active];
+    size_t tail_len = w->used;
+    if (w->flags & OUTPUT_WRITER_DIRECT) {
+        // O_DIRECT requires aligned length, so the rest is written through page cache
+        size_t aligned = tail_len / WRITER_ALIGNMENT * WRITER_ALIGNMENT;
+        if (error == 0) {
+            error = write_all(w->fd, tail, aligned);
+        }
+        tail += aligned;
+        tail_len -= aligned;
+        w->written += aligned;
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+    }
+    if (error == 0) {
+        error = write_all(w->fd, tail, tail_len);
+    }
+    w->written += tail_len;
+
+    if (w->flags & OUTPUT_WRITER_PREALLOCATE) {
+        ftruncate(w->fd, (off_t) w->written);
+    }
+    close(w->fd);
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w->buffers[0]);
+    free(w->buffers[1]);
+    free(w);
+    return error;
+}
@@ -0,0 +1,21 @@
+#ifndef ASSIGNMENT_1_LIBWRITER_H
+#define ASSIGNMENT_1_LIBWRITER_H
+
+#include <stddef.h>
+
+// Write with O_DIRECT, bypassing page cache. Falls back to buffered I/O if file system doesn't support it.
+#define OUTPUT_WRITER_DIRECT 0x1
+// Preallocate size_hint bytes with posix_fallocate(). The file is truncated to real size on close.
+#define OUTPUT_WRITER_PREALLOCATE 0x2
+
+// Sign, 10 digits and separator
+#define OUTPUT_WRITER_MAX_NUMBER_LEN 12
+
+// Numbers are formatted into one buffer while the other one is written to the file by a separate thread
+typedef struct output_writer output_writer;
+
+output_writer *output_writer_open(const char *const name, const int flags, const size_t size_hint);
+void output_writer_write_number(output_writer *const w, const int number);
+int output_writer_close(output_writer *const w);
+
+#endif //ASSIGNMENT_1_LIBWRITER_H
@@ -5,27 +5,15 @@
 #include <assert.h>
 #include <unistd.h>
 #include "libcoro.h"
+#include "libjob.h"
+#include "librun.h"
 #include "libsort.h"
 #include "libutil.h"
+#include "libwriter.h"
 
 #define COROUTINE_NAME_LEN 16
 
-typedef enum {
-    SORTING_WAITING,
-    SORTING_IN_PROGRESS,
-    SORTING_FINISHED,
-} sorting_status;
-
-typedef struct file_list {
-    const char *filename;
-    FILE *sorted_output;
-    sorting_status status;
-
-    struct file_list *next;
-} file_list;
-
-static file_list *g_sorted_files_head = NULL;
-static file_list *g_sorted_files_tail = NULL;
+static job_queue g_jobs = {0};
 
 uint64_t g_target_latency = 0;
 
@@ -36,17 +24,13 @@ static int coroutine_func_f(void *context) {
     struct coro *this = coro_this();
     size_t switch_cnt = 0;
 
-    file_list *cur = g_sorted_files_head;
+    sort_job *cur;
     uint64_t sumExecTime = 0;
-    while (cur != NULL) {
-        if (cur->status != SORTING_WAITING) {
-            cur = cur->next;
-            continue;
-        }
-
+    while ((cur = job_queue_next(&g_jobs)) != NULL) {
         uint64_t fileSortTime = 0;
         cur->status = SORTING_IN_PROGRESS;
-        cur->sorted_output = sort_file(g_target_latency, cur->filename, &switch_cnt, &fileSortTime);
+        cur->sorted_output = sort_file(g_target_latency, cur->filename, cur->offset, cur->len,
+                                       &switch_cnt, &fileSortTime);
         cur->status = SORTING_FINISHED;
         sumExecTime += fileSortTime;
     }
@@ -63,18 +47,35 @@ int main(int argc, char **argv)
 {
     uint64_t start_time = get_time_in_microsec();
 
+    /* Read options */
+    int opt;
+    int writer_flags = 0;
+    while ((opt = getopt(argc, argv, "zda")) != -1) {
+        switch (opt) {
+            case 'z':
+                run_set_spill_format(RUN_FORMAT_DELTA);
+                break;
+            case 'd':
+                writer_flags |= OUTPUT_WRITER_DIRECT;
+                break;
+            case 'a':
+                writer_flags |= OUTPUT_WRITER_PREALLOCATE;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-z] [-d] [-a] coroutine_pool_size target_latency [file_name...]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     /* Read coroutine pool, read all files to sort */
     long long coroutine_pool_size = strtol(argv[1], NULL, 10);
     g_target_latency = strtol(argv[2], NULL, 10);
-    for (int i = 3; i < argc; i++) {
-        if (g_sorted_files_head == NULL) {
-            g_sorted_files_head = g_sorted_files_tail = calloc(1, sizeof(file_list));
-        } else {
-            g_sorted_files_tail->next = calloc(1, sizeof(file_list));
-            g_sorted_files_tail = g_sorted_files_tail->next;
-        }
-        g_sorted_files_tail->status = SORTING_WAITING;
-        g_sorted_files_tail->filename = argv[i]; // Since main will live during execution time, I use argv safely
+    // Since main will live during execution time, I use argv safely
+    if (!job_queue_init(&g_jobs, &argv[3], argc - 3, coroutine_pool_size)) {
+        return EXIT_FAILURE;
     }
 
     /* Initialize our coroutine global cooperative scheduler. */
@@ -99,32 +100,33 @@ int main(int argc, char **argv)
     }
     /* All coroutines have finished. */
 
-    size_t file_cnt = argc - 3;
+    size_t file_cnt = g_jobs.count;
     FILE **files = (FILE **) calloc(file_cnt, sizeof(FILE *));
     size_t *file_lens = (size_t *) calloc(file_cnt, sizeof(size_t));
     int *cur_value = (int *) calloc(file_cnt, sizeof(int));
+    run_reader *readers = (run_reader *) calloc(file_cnt, sizeof(run_reader));
 
 
-    file_list *cur = g_sorted_files_head, *next;
-    size_t k = 0;
-    while (cur != NULL) {
-        assert(cur->status == SORTING_FINISHED);
+    size_t total_len = 0;
+    for (size_t k = 0; k < file_cnt; k++) {
+        assert(g_jobs.jobs[k].status == SORTING_FINISHED);
 
-        files[k] = cur->sorted_output;
-        rewind(files[k]);
-        file_lens[k] = count_numbers_in_file(files[k]);
+        files[k] = g_jobs.jobs[k].sorted_output;
         rewind(files[k]);
-
-        next = cur->next;
-        free(cur);
-        cur = next;
-        k++;
+        file_lens[k] = run_count(files[k], run_get_spill_format());
+        run_reader_init(&readers[k], files[k], run_get_spill_format());
+        total_len += file_lens[k];
     }
+    job_queue_free(&g_jobs);
 
-    FILE *output = fopen("output.txt", "w");
+    output_writer *output = output_writer_open("output.txt", writer_flags,
+                                               total_len * OUTPUT_WRITER_MAX_NUMBER_LEN);
+    if (output == NULL) {
+        return EXIT_FAILURE;
+    }
 
     for (size_t i = 0; i < file_cnt; i++) {
-        fscanf(files[i], "%d", &cur_value[i]);
+        run_read(&readers[i], &cur_value[i]);
     }
 
     bool merged = false;
@@ -143,8 +145,8 @@ int main(int argc, char **argv)
             }
         }
 
-        fprintf(output, "%d ", to_write);
-        fscanf(files[idx], "%d", &cur_value[idx]);
+        output_writer_write_number(output, to_write);
+        run_read(&readers[idx], &cur_value[idx]);
         file_lens[idx]--;
 
         merged = true;
@@ -153,8 +155,9 @@ int main(int argc, char **argv)
         }
     } while(!merged);
 
-    fflush(output);
-    fclose(output);
+    if (output_writer_close(output) != 0) {
+        printf("Failed to write output.txt\n");
+    }
 
     uint64_t end_time = get_time_in_microsec();
     printf("Execution time: ");
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Sorts generated files of different orders and checks output.txt: ./tests.sh [path/to/output]
+set -e
+exe=$(realpath "${1:-./output}")
+here=$(dirname "$(realpath "$0")")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+check() {
+    timeout 300 "$exe" "$@" > /dev/null
+    python3 "$here/checker.py" -f output.txt
+    expected=0
+    for arg in "$@"; do
+        if [ -f "$arg" ]; then
+            expected=$((expected + $(wc -w < "$arg")))
+        fi
+    done
+    if [ "$(wc -w < output.txt)" -ne "$expected" ]; then
+        echo "Expected $expected numbers in output.txt"
+        exit 1
+    fi
+}
+
+python3 "$here/generator.py" -f random.txt -c 1000000
+python3 "$here/generator.py" -f descending.txt -c 1000000 -m 100000 -o descending
+python3 "$here/generator.py" -f nearly.txt -c 3000000 -o nearly-sorted
+for file in random.txt descending.txt nearly.txt; do
+    echo "$file"
+    check 4 1000 "$file"
+done
+echo "all files, -z"
+check -z 4 1000 random.txt descending.txt nearly.txt
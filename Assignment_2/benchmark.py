@@ -0,0 +1,132 @@
+import subprocess
+import argparse
+import json
+import os
+import statistics
+import time
+
+parser = argparse.ArgumentParser(description='Benchmarks for shell')
+parser.add_argument('-e', type=str, default='./a.out',
+                    help='executable shell file')
+parser.add_argument('-o', type=str, help='file for the JSON report, stdout by default')
+parser.add_argument('--runs', type=int, default=20,
+                    help='repetitions of startup and latency measurements')
+parser.add_argument('--commands', type=int, default=1000,
+                    help='commands per latency measurement')
+parser.add_argument('--lines', type=int, default=10 ** 7,
+                    help='lines pushed through the pipeline')
+parser.add_argument('--pipe-sizes', type=int, nargs='*', default=[0, 256 * 1024, 1024 * 1024],
+                    help='pipe capacities for the throughput measurement, 0 is the default of the kernel')
+args = parser.parse_args()
+
+MARK = '__benchmark_mark__'
+
+
+def run_shell(script, shell_args=()):
+    start = time.perf_counter()
+    p = subprocess.run([args.e, *shell_args], input=script.encode(),
+                       stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    return time.perf_counter() - start, p.stdout
+
+
+def summary(samples, scale=1e3):
+    samples = [s * scale for s in samples]
+    return {
+        'min': min(samples),
+        'median': statistics.median(samples),
+        'mean': statistics.mean(samples),
+    }
+
+
+def startup():
+    samples = [run_shell('')[0] for _ in range(args.runs)]
+    return summary(samples)
+
+
+def latency(command):
+    """Per-command time in microseconds: time of N commands minus time of an empty shell, divided by N."""
+    script = '{}\n'.format(command) * args.commands
+    samples = []
+    for _ in range(args.runs):
+        empty = run_shell('')[0]
+        full = run_shell(script)[0]
+        samples.append(max(full - empty, 0) / args.commands)
+    return summary(samples, 1e6)
+
+
+def pipeline_throughput(pipe_size):
+    command = 'yes | head -n {} | wc -l\n'.format(args.lines)
+    elapsed, output = run_shell(command, ['-p', str(pipe_size)])
+    # Every line of yes is "y\n"
+    megabytes = args.lines * 2 / 2 ** 20
+    return {
+        'command': command.strip(),
+        'pipe_size': pipe_size,
+        'seconds': elapsed,
+        'mb_per_s': megabytes / elapsed,
+        'output': output.decode().strip(),
+    }
+
+
+def process_state(pid):
+    fds = len(os.listdir('/proc/{}/fd'.format(pid)))
+    zombies = 0
+    children = 0
+    for entry in os.listdir('/proc'):
+        if not entry.isdigit():
+            continue
+        try:
+            with open('/proc/{}/stat'.format(entry)) as f:
+                fields = f.read().rsplit(')', 1)[1].split()
+        except OSError:
+            continue
+        if int(fields[1]) != pid:
+            continue
+        children += 1
+        if fields[0] == 'Z':
+            zombies += 1
+    return {'fds': fds, 'children': children, 'zombies': zombies}
+
+
+def leaks():
+    """Runs foreground, piped and background commands in one shell, then looks at what is left in it."""
+    p = subprocess.Popen([args.e], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                         stderr=subprocess.STDOUT, bufsize=0)
+    before = process_state(p.pid)
+    commands = ['true', '/bin/true', 'echo 1 | cat', 'cat /dev/null | wc -l > /dev/null', '/bin/true &']
+    script = ''
+    for i in range(args.commands):
+        script += commands[i % len(commands)] + '\n'
+    script += 'sleep 0.2\necho {}\n'.format(MARK)
+    p.stdin.write(script.encode())
+
+    output = b''
+    while MARK.encode() not in output:
+        chunk = p.stdout.read(65536)
+        if not chunk:
+            break
+        output += chunk
+    after = process_state(p.pid)
+    p.stdin.close()
+    p.wait(5)
+    return {'commands': args.commands, 'before': before, 'after': after}
+
+
+report = {
+    'shell': args.e,
+    'startup_ms': startup(),
+    'latency_us': {
+        'builtin': latency('true'),
+        'external': latency('/bin/true'),
+        'pipeline': latency('/bin/true | /bin/true'),
+    },
+    'pipeline_throughput': [pipeline_throughput(size) for size in args.pipe_sizes],
+    'leaks': leaks(),
+}
+
+text = json.dumps(report, indent=2)
+if args.o:
+    with open(args.o, 'w') as f:
+        f.write(text + '\n')
+else:
+    print(text)
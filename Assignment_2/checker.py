@@ -12,6 +12,8 @@ parser.add_argument('-t', action='store_true', default=False,
 parser.add_argument('--max', type=int, choices=[15, 20, 25], default=15,
                     help='max points number')
 args = parser.parse_args()
+# Tests run in testdir, so the shell started by them needs an absolute path
+shell = os.path.abspath(args.e)
 
 tests = [
     [
@@ -61,6 +63,10 @@ tests = [
         "f.close()\\n\" > test.py",
         "python test.py | exit 0",
         "cat test.txt",
+        "echo x | cat | tee f1 | wc -c | tr -d [:blank:]",
+        "cat f1",
+        "echo hi | ( cat )",
+        "echo hi | ( cat ) | cat",
     ],
     [
         "false && echo 123",
@@ -73,6 +79,91 @@ tests = [
         "echo 100 | grep 1 || echo 200 | grep 2",
         "echo 100 | grep 1 && echo 200 | grep 2",
     ],
+    [
+        "true | false | nosuchcommand || echo $PIPESTATUS $PIPESTATUS_1 ${PIPESTATUS_2} [$PIPESTATUS_3]",
+        "nosuchcommand || echo $?",
+        "false | true && echo $PIPESTATUS",
+    ],
+    [
+        "sleep 0.5 | tee f &",
+        "jobs",
+        "wait",
+        "cd / &",
+        "wait",
+        "pwd | tail -c 8",
+        "exit 7 &",
+        "wait %1 || echo $?",
+    ],
+    [
+        "hash -r",
+        "hash cat",
+        "hash | sort | cut -f 1",
+        "hash nosuchcommand || echo $?",
+        "OLDPATH=$PATH",
+        "PATH=/usr/bin:/bin",
+        "hash | wc -l | tr -d [:blank:]",
+        "PATH=$OLDPATH",
+    ],
+    [
+        "sh -c 'sleep 0.1; echo slept' &",
+        "fg",
+        "sh -c 'exit 3' &",
+        "wait %1 || echo $?",
+        "jobs",
+        "wait foo || echo $?",
+        "fg %9 || echo $?",
+    ],
+    [
+        "yes abc | head -n 50000 > big.txt",
+        "cat big.txt > big2.txt",
+        "cat big.txt | cat >> big2.txt",
+        "cat big2.txt | wc -l | tr -d [:blank:]",
+        "cat big2.txt | cat | sort -u",
+        "echo first > out.txt",
+        "echo second | cat >> out.txt",
+        "echo third >> out.txt",
+        "cat out.txt",
+    ],
+    [
+        "parallel -j 2 echo {} x ::: 1 2 3",
+        "parallel -j 3 sh -c 'sleep 0.0{}; echo {}' ::: 3 1 2",
+        "parallel echo ::: a b | tr a-z A-Z",
+        "parallel -j 2 sh -c 'exit {}' ::: 0 5 0 || echo $?",
+        "parallel echo || echo $?",
+    ],
+    [
+        "X=hello",
+        "echo $X ${X}world '$X' \"$X\" [$NOSUCHVAR]",
+        "Y=env sh -c 'echo [$Y]'",
+        "echo [$Y]",
+        "sh -c 'echo [$X]'",
+        "export X",
+        "sh -c 'echo [$X]'",
+        "export Z=exported",
+        "sh -c 'echo $Z'",
+        "unset Z",
+        "sh -c 'echo [$Z]'",
+        "echo $$ > pid1",
+        "( echo $$ ) > pid2",
+        "cmp pid1 pid2 && echo same",
+    ],
+    [
+        "echo [$(echo a b | tr a-z A-Z)]",
+        "echo $(echo $(echo nested))",
+        "echo \"$(printf 'x\\n\\n')\"",
+        "echo [$(nosuchcommand)]",
+        "X=outer",
+        "( X=inner && echo $X )",
+        "echo $X",
+        "( echo sub1\necho sub2 ) | wc -l | tr -d [:blank:]",
+        "( exit 6 ) || echo $?",
+    ],
+    [
+        "sh -c \"'{}' -c 'time false | cat' 2>&1\" | cut -f 1,6".format(shell),
+        "'{}' -t trace.log -c 'sh -c \"exit 3\"' || echo $?".format(shell),
+        "cut -f 2,7 trace.log",
+    ],
+    # Background jobs print asynchronously, so they go last
     [
         "sleep 0.5 && echo 'back sleep is done' &",
         "echo 'next sleep is done'",
@@ -164,6 +255,33 @@ for test in tests:
         print('Expected {}, got {}'.format(test[1], p.returncode))
         exit_failure()
 
+# Test batch modes: the command line is taken from an argument or from a file
+# instead of stdin, the shell exits with the status of the last command.
+if args.max == 25:
+    with open('batch.sh', 'w') as f:
+        f.write("echo from script\nfalse || echo 1 |\\\ncat\nexit 4\n")
+    tests = [
+        (['-c', 'echo batch | tr a-z A-Z'], 'BATCH\n', 0),
+        (['-c', 'echo 1 && false'], '1\n', 1),
+        (['-f', 'batch.sh'], 'from script\n1\n', 4),
+        (['-f', 'nosuchscript.sh'], 'nosuchscript.sh: No such file or directory\n', 1),
+    ]
+    for test in tests:
+        try:
+            p = subprocess.run([args.e] + test[0], stdin=subprocess.DEVNULL,
+                               stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT, timeout=1)
+        except subprocess.TimeoutExpired:
+            print('Too long no output in test "{}"'.format(' '.join(test[0])))
+            finish(-1)
+        output = p.stdout.decode()
+        if output != test[1] or p.returncode != test[2]:
+            print('Wrong result in test "{}"'.format(' '.join(test[0])))
+            print('Expected exit code {} and output:\n{}'.format(test[2], test[1]))
+            print('Got exit code {} and output:\n{}'.format(p.returncode, output))
+            exit_failure()
+    os.remove('batch.sh')
+
 # Test an extra long command. To ensure the shell doesn't have an internal
 # buffer size limit (well, it always can allocate like 1GB, but this has to be
 # caught at review).
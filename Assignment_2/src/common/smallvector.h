@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Vector keeping its first elements in inline storage inside the owner, which covers the common case
+ * without allocations, and doubling its capacity beyond that. A zeroed vector is a valid empty one.
+ * The vector must not be copied by value: data may point into its own inline storage.
+ */
+#define SMALL_VECTOR(type, inlineCapacity) \
+    struct {                               \
+        type *data;                        \
+        size_t size;                       \
+        size_t capacity;                   \
+        type inlineData[inlineCapacity];   \
+    }
+
+static inline bool smallVectorGrow(void **data, size_t *capacity, void *inlineData, size_t inlineCapacity,
+                                   size_t required, size_t elementSize) {
+    if (*data == NULL) {
+        *data = inlineData;
+        *capacity = inlineCapacity;
+    }
+    if (required <= *capacity)
+        return true;
+
+    size_t newCapacity = *capacity * 2;
+    while (newCapacity < required)
+        newCapacity *= 2;
+    void *newData = *data == inlineData ? malloc(newCapacity * elementSize) : realloc(*data, newCapacity * elementSize);
+    if (newData == NULL)
+        return false;
+    if (*data == inlineData)
+        memcpy(newData, inlineData, *capacity * elementSize);
+    *data = newData;
+    *capacity = newCapacity;
+    return true;
+}
+
+#define smallVectorInlineCapacity(v) (sizeof((v)->inlineData) / sizeof((v)->inlineData[0]))
+
+// Makes room for required elements, returns false if memory can't be allocated
+#define smallVectorReserve(v, required)                                                       \
+    smallVectorGrow((void **) &(v)->data, &(v)->capacity, (v)->inlineData,                    \
+                    smallVectorInlineCapacity(v), (required), sizeof((v)->inlineData[0]))
+
+// Appends an uninitialized element and returns pointer to it, NULL if memory can't be allocated
+#define smallVectorPush(v) (smallVectorReserve((v), (v)->size + 1) ? &(v)->data[(v)->size++] : NULL)
+
+#define smallVectorFree(v)                          \
+    do {                                            \
+        if ((v)->data != (v)->inlineData)           \
+            free((v)->data);                        \
+        (v)->data = NULL;                           \
+        (v)->size = 0;                              \
+        (v)->capacity = 0;                          \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
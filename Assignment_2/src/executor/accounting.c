@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "accounting.h"
+
+static FILE *trace = NULL;
+
+static double seconds(const struct timespec *from, const struct timespec *to) {
+    return (double) (to->tv_sec - from->tv_sec) + (double) (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double timevalSeconds(const struct timeval *tv) {
+    return (double) tv->tv_sec + (double) tv->tv_usec / 1e6;
+}
+
+static void timevalSub(struct timeval *result, const struct timeval *a, const struct timeval *b) {
+    result->tv_sec = a->tv_sec - b->tv_sec;
+    result->tv_usec = a->tv_usec - b->tv_usec;
+    if (result->tv_usec < 0) {
+        result->tv_sec--;
+        result->tv_usec += 1000000;
+    }
+}
+
+void accountingStart(StageUsage *stage, const char *name) {
+    memset(&stage->usage, 0, sizeof(stage->usage));
+    snprintf(stage->name, sizeof(stage->name), "%s", name != NULL ? name : "");
+    clock_gettime(CLOCK_MONOTONIC, &stage->started);
+    stage->finished = stage->started;
+}
+
+int accountingWait(StageUsage *stage, int pid, int *status, int options) {
+    int ret = wait4(pid, status, options, &stage->usage);
+    if (ret > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &stage->finished);
+    }
+    return ret;
+}
+
+void accountingFinishSelf(StageUsage *stage, const struct rusage *before) {
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    clock_gettime(CLOCK_MONOTONIC, &stage->finished);
+    timevalSub(&stage->usage.ru_utime, &after.ru_utime, &before->ru_utime);
+    timevalSub(&stage->usage.ru_stime, &after.ru_stime, &before->ru_stime);
+    stage->usage.ru_maxrss = after.ru_maxrss;
+}
+
+static void printTime(FILE *out, const char *label, double value) {
+    int minutes = (int) (value / 60);
+    fprintf(out, "%s\t%dm%.3fs\n", label, minutes, value - minutes * 60);
+}
+
+void accountingPrintTimes(FILE *out, const struct timespec *started, const StageUsage *const *stages, size_t count) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double user = 0;
+    double sys = 0;
+    for (size_t i = 0; i < count; i++) {
+        user += timevalSeconds(&stages[i]->usage.ru_utime);
+        sys += timevalSeconds(&stages[i]->usage.ru_stime);
+    }
+    printTime(out, "real", seconds(started, &now));
+    printTime(out, "user", user);
+    printTime(out, "sys", sys);
+    if (count == 0)
+        return;
+
+    fprintf(out, "stage\treal\tuser\tsys\tmaxrss\tcommand\n");
+    for (size_t i = 0; i < count; i++) {
+        const StageUsage *stage = stages[i];
+        fprintf(out, "%zu\t%.3f\t%.3f\t%.3f\t%ldK\t%s\n", i + 1, seconds(&stage->started, &stage->finished),
+                timevalSeconds(&stage->usage.ru_utime), timevalSeconds(&stage->usage.ru_stime),
+                stage->usage.ru_maxrss, stage->name);
+    }
+}
+
+bool accountingOpenTrace(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    FILE *file = fdopen(fd, "a");
+    if (file == NULL) {
+        printf("%s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    // Children are forked with nothing buffered
+    setvbuf(file, NULL, _IOLBF, 0);
+    if (trace != NULL) {
+        fclose(trace);
+    }
+    trace = file;
+    return true;
+}
+
+bool accountingTracing() {
+    return trace != NULL;
+}
+
+void accountingTrace(const StageUsage *stage, int pid, int status) {
+    if (trace == NULL)
+        return;
+    fprintf(trace, "%d\t%d\t%.6f\t%.6f\t%.6f\t%ld\t%s\n", pid, status, seconds(&stage->started, &stage->finished),
+            timevalSeconds(&stage->usage.ru_utime), timevalSeconds(&stage->usage.ru_stime),
+            stage->usage.ru_maxrss, stage->name);
+}
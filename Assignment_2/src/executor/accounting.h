@@ -0,0 +1,42 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Resource accounting of children: wall time from start to reaping and rusage given by wait4.
+ * It is printed by the time prefix of a pipeline and written to the trace log, one line per reaped child.
+ */
+
+// Stage names are cut to that length
+#define ACCOUNTING_NAME_LEN 32
+
+typedef struct {
+    struct timespec started;
+    struct timespec finished;
+    struct rusage usage;
+    char name[ACCOUNTING_NAME_LEN];
+} StageUsage;
+
+void accountingStart(StageUsage *stage, const char *name);
+// Reaps the child with wait4, which fills usage, and stops the wall clock of the stage. Returns like waitpid.
+int accountingWait(StageUsage *stage, int pid, int *status, int options);
+// Stage run by the shell itself: usage is the difference of usage of the shell since before
+void accountingFinishSelf(StageUsage *stage, const struct rusage *before);
+
+// time: real time since started, user and sys time summed over the stages, then every stage on its own line
+void accountingPrintTimes(FILE *out, const struct timespec *started, const StageUsage *const *stages, size_t count);
+
+// Appends trace lines to the file: pid, status, real, user and sys seconds, max RSS in KB and the command
+bool accountingOpenTrace(const char *path);
+bool accountingTracing();
+void accountingTrace(const StageUsage *stage, int pid, int status);
+
+#ifdef __cplusplus
+}
+#endif
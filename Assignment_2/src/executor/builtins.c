@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "executor.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "relay.h"
+#include "vars.h"
+#include "input.h"
+
+// Exit status of a builtin called with wrong arguments, like in bash
+#define EXIT_USAGE 2
+
+typedef struct {
+    const char *name;
+    BuiltinHandler handler;
+} Builtin;
+
+static int builtinCd(Command *token, BuiltinContext *ctx) {
+    const char *dir = token->argc < 2 ? varsGet("HOME") : token->argv[1];
+    if (dir == NULL) {
+        dir = "/";
+    }
+    if (ctx->subshell) {
+        struct stat st;
+        return stat(dir, &st) == 0 && S_ISDIR(st.st_mode) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (chdir(dir) != 0) {
+        fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int builtinHash(Command *token, BuiltinContext *ctx) {
+    if (token->argc < 2) {
+        pathCachePrint(ctx->out);
+        return EXIT_SUCCESS;
+    }
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 1; i < token->argc; i++) {
+        if (strcmp(token->argv[i], "-r") == 0) {
+            pathCacheClear();
+        } else if (strcmp(token->argv[i], "-a") == 0) {
+            pathCacheScan();
+        } else if (pathCacheLookup(token->argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", token->argv[i]);
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
+
+static int builtinJobs(Command *token, BuiltinContext *ctx) {
+    (void) token;
+    jobsPrint(ctx->out);
+    return EXIT_SUCCESS;
+}
+
+static int builtinWait(Command *token, BuiltinContext *ctx) {
+    (void) ctx;
+    if (token->argc < 2) {
+        return jobsWait(0);
+    }
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 1; i < token->argc; i++) {
+        int id = jobsParseId(token->argv[i]);
+        if (id < 0) {
+            fprintf(stderr, "wait: %s: not a job reference\n", token->argv[i]);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        ret = jobsWait(id);
+    }
+    return ret;
+}
+
+static int builtinFg(Command *token, BuiltinContext *ctx) {
+    (void) ctx;
+    int id = token->argc < 2 ? 0 : jobsParseId(token->argv[1]);
+    if (id < 0) {
+        fprintf(stderr, "fg: %s: not a job reference\n", token->argv[1]);
+        return EXIT_FAILURE;
+    }
+    return jobsForeground(id);
+}
+
+static int builtinEcho(Command *token, BuiltinContext *ctx) {
+    size_t first = 1;
+    bool newline = true;
+    if (token->argc > 1 && strcmp(token->argv[1], "-n") == 0) {
+        newline = false;
+        first++;
+    }
+    for (size_t i = first; i < token->argc; i++) {
+        if (i > first)
+            putc_unlocked(' ', ctx->out);
+        fputs(token->argv[i], ctx->out);
+    }
+    if (newline)
+        putc_unlocked('\n', ctx->out);
+    return EXIT_SUCCESS;
+}
+
+static int builtinTrue(Command *token, BuiltinContext *ctx) {
+    (void) token;
+    (void) ctx;
+    return EXIT_SUCCESS;
+}
+
+static int builtinFalse(Command *token, BuiltinContext *ctx) {
+    (void) token;
+    (void) ctx;
+    return EXIT_FAILURE;
+}
+
+static int builtinPwd(Command *token, BuiltinContext *ctx) {
+    (void) token;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    fprintf(ctx->out, "%s\n", cwd);
+    return EXIT_SUCCESS;
+}
+
+static int builtinExit(Command *token, BuiltinContext *ctx) {
+    int status = executorLastStatus();
+    if (token->argc > 1) {
+        char *end = NULL;
+        long value = strtol(token->argv[1], &end, 10);
+        if (end == token->argv[1] || *end != 0) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", token->argv[1]);
+            value = EXIT_USAGE;
+        }
+        status = (int) (value & 0xff);
+    }
+    if (ctx->subshell) {
+        return status;
+    }
+    fflush(stdout);
+    exit(status);
+}
+
+static bool parseNumber(const char *arg, long *value) {
+    char *end = NULL;
+    *value = strtol(arg, &end, 10);
+    return end != arg && *end == 0;
+}
+
+/* test with one argument checks that it is not empty, with two it is a unary operator. */
+static int testUnary(const char *op, const char *arg) {
+    struct stat st;
+    if (strcmp(op, "-n") == 0)
+        return arg[0] != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-z") == 0)
+        return arg[0] == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-e") == 0)
+        return stat(arg, &st) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-f") == 0)
+        return stat(arg, &st) == 0 && S_ISREG(st.st_mode) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-d") == 0)
+        return stat(arg, &st) == 0 && S_ISDIR(st.st_mode) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-s") == 0)
+        return stat(arg, &st) == 0 && st.st_size > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-r") == 0)
+        return access(arg, R_OK) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-w") == 0)
+        return access(arg, W_OK) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "-x") == 0)
+        return access(arg, X_OK) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    fprintf(stderr, "test: %s: unary operator expected\n", op);
+    return EXIT_USAGE;
+}
+
+static int testBinary(const char *left, const char *op, const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    static const char *const ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    size_t opIndex = 0;
+    while (opIndex < sizeof(ops) / sizeof(ops[0]) && strcmp(op, ops[opIndex]) != 0)
+        opIndex++;
+    if (opIndex == sizeof(ops) / sizeof(ops[0])) {
+        fprintf(stderr, "test: %s: binary operator expected\n", op);
+        return EXIT_USAGE;
+    }
+    long a, b;
+    if (!parseNumber(left, &a) || !parseNumber(right, &b)) {
+        fprintf(stderr, "test: integer expression expected\n");
+        return EXIT_USAGE;
+    }
+    bool result[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return result[opIndex] ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Expression of test without the -a and -o connectives. */
+static int testExpression(char **args, size_t count) {
+    if (count > 0 && strcmp(args[0], "!") == 0) {
+        int ret = testExpression(args + 1, count - 1);
+        return ret == EXIT_USAGE ? ret : !ret;
+    }
+    switch (count) {
+        case 0:
+            return EXIT_FAILURE;
+        case 1:
+            return args[0][0] != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        case 2:
+            return testUnary(args[0], args[1]);
+        case 3:
+            return testBinary(args[0], args[1], args[2]);
+        default:
+            fprintf(stderr, "test: too many arguments\n");
+            return EXIT_USAGE;
+    }
+}
+
+static int builtinTest(Command *token, BuiltinContext *ctx) {
+    (void) ctx;
+    size_t count = token->argc - 1;
+    if (strcmp(token->name, "[") == 0) {
+        if (count == 0 || strcmp(token->argv[count], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return EXIT_USAGE;
+        }
+        count--;
+    }
+    return testExpression(token->argv + 1, count);
+}
+
+static int builtinTee(Command *token, BuiltinContext *ctx) {
+    size_t first = 1;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC;
+    if (token->argc > 1 && strcmp(token->argv[1], "-a") == 0) {
+        flags = O_WRONLY | O_CREAT | O_CLOEXEC | O_APPEND;
+        first++;
+    }
+
+    int ret = EXIT_SUCCESS;
+    int *files = (int *) calloc(token->argc, sizeof(int));
+    size_t fileCount = 0;
+    for (size_t i = first; i < token->argc; i++) {
+        int fd = open(token->argv[i], flags, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "tee: %s: %s\n", token->argv[i], strerror(errno));
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        files[fileCount++] = fd;
+    }
+
+    fflush(ctx->out);
+    int relayError = relayTee(ctx->inputFd, fileno(ctx->out), files, fileCount);
+    if (relayError != 0 && relayError != EPIPE) {
+        fprintf(stderr, "tee: %s\n", strerror(relayError));
+        ret = EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < fileCount; i++) {
+        close(files[i]);
+    }
+    free(files);
+    return ret;
+}
+
+#define PARALLEL_SEPARATOR ":::"
+
+/* parallel [-j N] command [args...] ::: inputs... */
+static int builtinParallel(Command *token, BuiltinContext *ctx) {
+    size_t first = 1;
+    long jobs = 0;
+    if (token->argc > 2 && strcmp(token->argv[1], "-j") == 0) {
+        char *end = NULL;
+        jobs = strtol(token->argv[2], &end, 10);
+        if (end == token->argv[2] || *end != 0 || jobs < 0) {
+            fprintf(stderr, "parallel: %s: bad number of jobs\n", token->argv[2]);
+            return EXIT_USAGE;
+        }
+        first = 3;
+    }
+    size_t separator = first;
+    while (separator < token->argc && strcmp(token->argv[separator], PARALLEL_SEPARATOR) != 0)
+        separator++;
+    if (separator == first || separator == token->argc) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] command [args...] ::: inputs...\n");
+        return EXIT_USAGE;
+    }
+
+    return executorRunParallel(token->argv + first, separator - first, token->argv + separator + 1,
+                               token->argc - separator - 1, (size_t) jobs, ctx->out);
+}
+
+/* export [NAME[=value]...]: marks variables to be passed to commands, prints them without arguments */
+static int builtinExport(Command *token, BuiltinContext *ctx) {
+    if (token->argc < 2) {
+        varsPrintExported(ctx->out);
+        return EXIT_SUCCESS;
+    }
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 1; i < token->argc; i++) {
+        const char *arg = token->argv[i];
+        const char *eq = strchr(arg, '=');
+        size_t nameLen = eq != NULL ? (size_t) (eq - arg) : strlen(arg);
+        if (!varsIsName(arg, nameLen)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", arg);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        if (ctx->subshell)
+            continue;
+        char *name = strndup(arg, nameLen);
+        bool ok = name != NULL && (eq != NULL ? varsSet(name, eq + 1, true) : varsExport(name));
+        free(name);
+        if (!ok) {
+            fprintf(stderr, "export: failed to set %s\n", arg);
+            ret = EXIT_FAILURE;
+        }
+    }
+    return ret;
+}
+
+static int builtinUnset(Command *token, BuiltinContext *ctx) {
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 1; i < token->argc; i++) {
+        if (!varsIsName(token->argv[i], strlen(token->argv[i]))) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", token->argv[i]);
+            ret = EXIT_FAILURE;
+        } else if (!ctx->subshell) {
+            varsUnset(token->argv[i]);
+        }
+    }
+    return ret;
+}
+
+static int builtinHistory(Command *token, BuiltinContext *ctx) {
+    (void) token;
+    historyPrint(ctx->out);
+    return EXIT_SUCCESS;
+}
+
+static const Builtin builtins[] = {
+        {"cd",    builtinCd},
+        {"hash",  builtinHash},
+        {"jobs",  builtinJobs},
+        {"wait",  builtinWait},
+        {"fg",    builtinFg},
+        {"echo",  builtinEcho},
+        {"true",  builtinTrue},
+        {"false", builtinFalse},
+        {"pwd",   builtinPwd},
+        {"exit",  builtinExit},
+        {"test",  builtinTest},
+        {"[",     builtinTest},
+        {"tee",   builtinTee},
+        {"parallel", builtinParallel},
+        {"export", builtinExport},
+        {"unset", builtinUnset},
+        {"history", builtinHistory},
+};
+
+BuiltinHandler builtinFind(const char *name) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (builtins[i].name[0] == name[0] && strcmp(builtins[i].name, name) == 0)
+            return builtins[i].handler;
+    }
+    return NULL;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+#include "parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Commands run by the shell itself, without a process. A builtin which is a stage of a pipeline of several
+ * commands behaves like in a subshell: exit and cd don't change the shell.
+ */
+
+typedef struct {
+    FILE *out;
+    int inputFd;
+    bool subshell;
+} BuiltinContext;
+
+typedef int (*BuiltinHandler)(Command *token, BuiltinContext *ctx);
+
+// Returns handler of the builtin or NULL if the command is not a builtin
+BuiltinHandler builtinFind(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
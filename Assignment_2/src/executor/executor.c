@@ -1,240 +1,1159 @@
 //
 // Created by kinjalik on 3/10/23.
 //
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
 #include <wait.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include "executor.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "smallvector.h"
+#include "vars.h"
+#include "accounting.h"
+#include "forkserver.h"
 
-#define PATH "PATH"
-
-static bool resolvePath(const char *name, char resolvedName[RESOLVED_NAME_MAX_LEN]);
-static void executeProgram(int p[2], char *resolvedName, Command *token);
-
-#define INITIAL_HANDLER_ARRAY_LEN 8
-#define HANDLER_ARRAY_EXTENSION 2
+// Pipelines up to that length don't allocate
+#define INLINE_PIPELINE_LEN 8
+// Word before a pipeline which prints how long it has run
+#define TIME_PREFIX "time"
 typedef struct {
+    // 0 for stages which have no process: builtins run by the shell and commands which failed to start
     int pid;
     int inputFd;
+    // Pipe to the next stage of pipeline, -1 if stdout goes directly to the terminal or a file
     int outputPipe[2];
+    int status;
+    StageUsage usage;
 } Handler;
 
 typedef struct {
-    Handler *arr;
-    size_t capacity;
-    size_t size;
+    SMALL_VECTOR(Handler, INLINE_PIPELINE_LEN) stages;
+    // Input of the first stage: our stdin for foreground pipelines, /dev/null for background ones
+    int inputFd;
+    // Stages are timed, for the time prefix or the trace log
+    bool timed;
 } HandlerArray;
 
+static void arrayInit(HandlerArray *h, int inputFd) {
+    memset(&h->stages, 0, sizeof(h->stages));
+    h->inputFd = inputFd;
+    h->timed = accountingTracing();
+}
 
-static HandlerArray arrayInit() {
-    Handler *arr = (Handler *) calloc(INITIAL_HANDLER_ARRAY_LEN, sizeof(Handler));
-    if (arr == NULL) {
-        printf("Failed to allocate array of process handlers");
+/* Closes fds which stages still own, e.g. after a failure, and frees the array. */
+static void arrayFree(HandlerArray *h) {
+    for (size_t i = 0; i < h->stages.size; i++) {
+        Handler *stage = &h->stages.data[i];
+        if (stage->inputFd != h->inputFd)
+            close(stage->inputFd);
+        if (stage->outputPipe[0] >= 0)
+            close(stage->outputPipe[0]);
+        if (stage->outputPipe[1] >= 0)
+            close(stage->outputPipe[1]);
     }
+    smallVectorFree(&h->stages);
+}
 
-    HandlerArray ret = {
-            .arr = arr,
-            .capacity = arr != NULL ? INITIAL_HANDLER_ARRAY_LEN : 0,
-            .size = 0
-    };
+/*
+ * posix_spawn() doesn't copy page tables of the shell (glibc uses CLONE_VM | CLONE_VFORK),
+ * so it is used whenever the child only needs fd redirections before exec.
+ */
+static int spawnProgram(const char *resolvedName, Command *token, char **envp, int inputFd, int outputFd, int *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (inputFd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, inputFd, STDIN_FILENO);
+    }
+    if (outputFd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, outputFd, STDOUT_FILENO);
+    }
+
+    // Builtins run with SIGPIPE blocked, children must not inherit that
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t emptyMask;
+    sigemptyset(&emptyMask);
+    posix_spawnattr_setsigmask(&attr, &emptyMask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    int ret = posix_spawn(pid, resolvedName, &actions, &attr, token->argv, envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
     return ret;
 }
 
-static void extendArray(HandlerArray *hndlr) {
-    size_t newCap = hndlr->capacity + HANDLER_ARRAY_EXTENSION;
-    Handler *newArr = (Handler *) calloc(newCap, sizeof(Handler));
-    if (newArr == NULL) {
-        printf("Failed to extend array");
-        return;
+/* Fallback for commands which can't be spawned, e.g. not found ones: the child reports the error itself. */
+static int forkProgram(const char *resolvedName, Command *token, char **envp, int inputFd, int outputFd, int *pid) {
+    fflush(stdout);
+    *pid = fork();
+    if (*pid < 0) {
+        return errno;
+    }
+    if (*pid == 0) {
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+        if (inputFd != STDIN_FILENO) {
+            dup2(inputFd, STDIN_FILENO);
+        }
+        if (outputFd != STDOUT_FILENO) {
+            dup2(outputFd, STDOUT_FILENO);
+        }
+        // Statuses of sh: 126 if the command can't be executed, 127 if it is not found
+        if (resolvedName != NULL) {
+            execve(resolvedName, token->argv, envp);
+            fprintf(stderr, "%s: %s\n", token->name, strerror(errno));
+            _exit(126);
+        }
+        fprintf(stderr, "%s: command not found\n", token->name);
+        _exit(127);
     }
-    memcpy(newArr, hndlr->arr, sizeof(Handler) * hndlr->size);
-    free(hndlr->arr);
-    hndlr->arr = newArr;
-    hndlr->capacity = newCap;
+    return 0;
 }
 
-static void arrayFree(HandlerArray *h) {
-    free(h->arr);
-    h->size = 0;
-    h->capacity = 0;
+/*
+ * Opens files of the redirections of the command in order, like bash does, so each of them is created or truncated.
+ * Returns fd of the last one, STDOUT_FILENO if there are none or -1 if a file can't be opened.
+ */
+static int openOutput(Command *token) {
+    int fd = STDOUT_FILENO;
+    for (size_t i = 0; i < token->redirectionCount; i++) {
+        Redirection *redirection = &token->redirections[i];
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        flags |= redirection->type == COMMAND_TYPE_OPERATOR_APPEND ? O_APPEND : O_TRUNC;
+        fd = open(redirection->target, flags, 0644);
+        if (fd < 0) {
+            printf("%s: %s\n", redirection->target, strerror(errno));
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Capacity of pipes between stages, 0 keeps the default of the kernel
+static int pipeSize = 0;
+
+void executorSetPipeSize(int bytes) {
+    pipeSize = bytes;
 }
 
-static int executeRegular(Command *token, HandlerArray *hndlrs) {
-    char resolvedName[RESOLVED_NAME_MAX_LEN] = {0};
-    bool resolved = resolvePath(token->name, resolvedName);
+bool executorSetTraceLog(const char *path) {
+    return accountingOpenTrace(path);
+}
+
+bool executorStartForkServer() {
+    return forkServerStart();
+}
 
-    if (hndlrs->size == hndlrs->capacity) {
-        extendArray(hndlrs);
+/*
+ * Adds the next stage to the pipeline: its input is the pipe from the previous stage or the input of the pipeline.
+ * With piped set, it gets a pipe to the next stage.
+ */
+static Handler *addStage(HandlerArray *hndlrs, bool piped) {
+    Handler *h = smallVectorPush(&hndlrs->stages);
+    if (h == NULL) {
+        printf("Failed to extend array of process handlers\n");
+        exit(EXIT_FAILURE);
     }
-    Handler *h = &hndlrs->arr[hndlrs->size];
+    Handler *prev = hndlrs->stages.size > 1 ? &hndlrs->stages.data[hndlrs->stages.size - 2] : NULL;
 
-    h->inputFd = hndlrs->size > 0 ? hndlrs->arr[hndlrs->size - 1].outputPipe[0] : STDIN_FILENO;
-    hndlrs->size++;
-    pipe(h->outputPipe);
+    h->pid = 0;
+    h->status = EXIT_SUCCESS;
+    h->inputFd = hndlrs->inputFd;
+    if (prev != NULL && prev->outputPipe[0] >= 0) {
+        h->inputFd = prev->outputPipe[0];
+        prev->outputPipe[0] = -1;
+    }
+    h->outputPipe[0] = h->outputPipe[1] = -1;
+    if (piped) {
+        // Children get only the fds they dup2, the rest of the pipes are closed on exec
+        pipe2(h->outputPipe, O_CLOEXEC);
+        // Above /proc/sys/fs/pipe-max-size it fails for unprivileged users, the pipe just keeps its size then
+        if (pipeSize > 0 && h->outputPipe[1] >= 0) {
+            fcntl(h->outputPipe[1], F_SETPIPE_SZ, pipeSize);
+        }
+    }
+    return h;
+}
 
+/*
+ * Forked stage which doesn't exec, so close-on-exec doesn't apply: drops pipe ends the shell still holds for other
+ * stages, e.g. the output of a builtin of the first stage which runs later, or their readers would never get EOF.
+ */
+static void closeOtherStages(HandlerArray *hndlrs, Handler *own) {
+    for (size_t i = 0; i < hndlrs->stages.size; i++) {
+        Handler *stage = &hndlrs->stages.data[i];
+        if (stage != own && stage->inputFd != hndlrs->inputFd)
+            close(stage->inputFd);
+        if (stage->outputPipe[0] >= 0)
+            close(stage->outputPipe[0]);
+        if (stage != own && stage->outputPipe[1] >= 0)
+            close(stage->outputPipe[1]);
+    }
+}
+
+/* Where stdout of the stage goes: the redirection wins over the pipe, then the next stage just gets EOF. */
+static int stageOutput(Handler *h, int outputFd) {
+    if (outputFd != STDOUT_FILENO || h->outputPipe[1] < 0)
+        return outputFd;
+    return h->outputPipe[1];
+}
+
+/* Closes fds of the stage which the shell doesn't need once the stage has started. */
+static void releaseStage(HandlerArray *hndlrs, Handler *h, int outputFd) {
+    if (h->inputFd != hndlrs->inputFd) {
+        close(h->inputFd);
+        h->inputFd = hndlrs->inputFd;
+    }
+    if (h->outputPipe[1] >= 0) {
+        close(h->outputPipe[1]);
+        h->outputPipe[1] = -1;
+    }
+    if (outputFd != STDOUT_FILENO) {
+        close(outputFd);
+    }
+}
+
+static int startProcess(Command *token, char **envp, Handler *h, int outputFd) {
+    const char *resolvedName = pathCacheLookup(token->name);
+    // Children write directly to our stdout, so everything printed by the shell must go first
+    fflush(stdout);
+    int ret = -1;
+    if (resolvedName != NULL && forkServerRunning()) {
+        ret = forkServerSpawn(resolvedName, token->argv, envp, h->inputFd, outputFd, &h->pid);
+    }
+    if (ret != 0 && resolvedName != NULL) {
+        ret = spawnProgram(resolvedName, token, envp, h->inputFd, outputFd, &h->pid);
+    }
+    if (ret != 0) {
+        ret = forkProgram(resolvedName, token, envp, h->inputFd, outputFd, &h->pid);
+    }
+    return ret;
+}
+
+#define SUBSTITUTION_READ_CHUNK (64 * 1024)
+
+/* Body of a forked shell: runs the text of ( ... ) or $(...) and exits with its status. */
+static void runSubshell(const char *text, size_t len) {
+    jobsForget();
+    forkServerForget();
+    char *copy = strndup(text, len);
+    if (copy == NULL) {
+        printf("Failed to allocate subshell\n");
+        exit(EXIT_FAILURE);
+    }
+    int status = executorRunScript(copy, len);
+    fflush(stdout);
+    exit(status);
+}
+
+/*
+ * $(...): runs the command in a forked shell with stdout on a pipe and returns everything it has printed,
+ * without trailing newlines. The output is read with large reads into a buffer which doubles when full.
+ */
+static char *substituteCommand(const char *command, size_t len) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        printf("Failed to create pipe: %s\n", strerror(errno));
+        return NULL;
+    }
+    StageUsage usage;
+    accountingStart(&usage, "$(...)");
+    fflush(stdout);
     int pid = fork();
+    if (pid < 0) {
+        printf("Failed to fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
     if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        runSubshell(command, len);
+    }
+    close(fds[1]);
+
+    size_t size = 0;
+    size_t capacity = SUBSTITUTION_READ_CHUNK;
+    char *output = (char *) malloc(capacity + 1);
+    while (output != NULL) {
+        if (capacity - size < SUBSTITUTION_READ_CHUNK / 2) {
+            char *newOutput = (char *) realloc(output, capacity * 2 + 1);
+            if (newOutput == NULL)
+                break;
+            output = newOutput;
+            capacity *= 2;
+        }
+        ssize_t got = read(fds[0], output + size, capacity - size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        size += got;
+    }
+    close(fds[0]);
+    int status = 0;
+    while (accountingWait(&usage, pid, &status, 0) < 0 && errno == EINTR);
+    accountingTrace(&usage, pid, decodeWaitStatus(status));
+
+    if (output == NULL)
+        return NULL;
+    while (size > 0 && output[size - 1] == '\n')
+        size--;
+    output[size] = 0;
+    return output;
+}
+
+/* ( ... ): the whole group runs in one forked shell, which is the process of the stage. */
+static int forkSubshell(Command *token, HandlerArray *hndlrs, Handler *h, int outputFd) {
+    fflush(stdout);
+    h->pid = fork();
+    if (h->pid < 0) {
+        h->pid = 0;
+        return errno;
+    }
+    if (h->pid == 0) {
         if (h->inputFd != STDIN_FILENO) {
-            printf("pid %u, change STDIN to %d", pid, h->inputFd);
-            dup2(h->inputFd, 0);
+            dup2(h->inputFd, STDIN_FILENO);
         }
+        if (outputFd != STDOUT_FILENO) {
+            dup2(outputFd, STDOUT_FILENO);
+        }
+        closeOtherStages(hndlrs, h);
+        runSubshell(token->subshell, strlen(token->subshell));
+    }
+    return 0;
+}
 
-        close(h->outputPipe[0]);
-        static bool flag = false;
-        dup2(h->outputPipe[1], 1);
-        dup2(h->outputPipe[1], 2);
-        close(h->outputPipe[1]);
-        if (resolved) {
-            execv(resolvedName, token->argv);
-        } else {
-            printf("Command not found");
+/* Copy of the command with variable references replaced by their values, freed with freeExpanded. */
+static bool expandCommand(Command *token, Command *expanded) {
+    *expanded = *token;
+    expanded->expand = false;
+    expanded->argv = (char **) calloc(token->argc + 1, sizeof(char *));
+    expanded->redirections = (Redirection *) calloc(token->redirectionCount + 1, sizeof(Redirection));
+    if (expanded->argv == NULL || expanded->redirections == NULL)
+        return false;
+    for (size_t i = 0; i < token->argc; i++) {
+        expanded->argv[i] = varsExpand(token->argv[i], substituteCommand);
+        if (expanded->argv[i] == NULL)
+            return false;
+    }
+    for (size_t i = 0; i < token->redirectionCount; i++) {
+        expanded->redirections[i].type = token->redirections[i].type;
+        expanded->redirections[i].target = varsExpand(token->redirections[i].target, substituteCommand);
+        if (expanded->redirections[i].target == NULL)
+            return false;
+    }
+    expanded->name = expanded->argv[0];
+    return true;
+}
+
+static void freeExpanded(Command *expanded) {
+    if (expanded->argv != NULL) {
+        for (size_t i = 0; i < expanded->argc; i++)
+            free(expanded->argv[i]);
+    }
+    if (expanded->redirections != NULL) {
+        for (size_t i = 0; i < expanded->redirectionCount; i++)
+            free(expanded->redirections[i].target);
+    }
+    free(expanded->argv);
+    free(expanded->redirections);
+}
+
+static Command *stageCommand(Pipeline *pipeline, Command *expanded, size_t i) {
+    return pipeline->commands[i].expand ? &expanded[i] : &pipeline->commands[i];
+}
+
+static const char *stageName(Command *token) {
+    if (token->subshell != NULL)
+        return "( ... )";
+    for (size_t i = 0; i < token->argc; i++) {
+        if (!varsIsAssignment(token->argv[i]))
+            return token->argv[i];
+    }
+    return "";
+}
+
+/* Number of NAME=value words before the command name */
+static size_t assignmentCount(Command *token) {
+    size_t count = 0;
+    while (count < token->argc && varsIsAssignment(token->argv[count]))
+        count++;
+    return count;
+}
+
+/* Sets shell variables of a command made of assignments only */
+static int assignVariables(Command *token) {
+    for (size_t i = 0; i < token->argc; i++) {
+        const char *eq = strchr(token->argv[i], '=');
+        char *name = strndup(token->argv[i], eq - token->argv[i]);
+        bool ok = name != NULL && varsSet(name, eq + 1, false);
+        free(name);
+        if (!ok) {
+            printf("Failed to set %s\n", token->argv[i]);
+            return EXIT_FAILURE;
         }
-        exit(0);
-    } else {
-        close(h->outputPipe[1]);
-        h->pid = pid;
     }
     return EXIT_SUCCESS;
 }
 
-static int syncPointProc(HandlerArray *hndlrs, FILE *outFile) {
-    if (hndlrs->size == 0)
-        return 0;
-
-    Handler *hLast = &hndlrs->arr[--hndlrs->size];
-    int status;
-    waitpid(hLast->pid, &status, 0);
-    int ret = WEXITSTATUS(status);
+/*
+ * Environment of a process started with NAME=value words before its name: the words themselves become entries,
+ * replacing exported variables of the same names. Only the array is allocated, entries are borrowed.
+ */
+static char **commandEnvironment(char **assignments, size_t count) {
+    char **envp = varsEnvironment();
+    size_t size = 0;
+    while (envp[size] != NULL)
+        size++;
+    char **result = (char **) calloc(size + count + 1, sizeof(char *));
+    if (result == NULL)
+        return NULL;
+    size_t n = 0;
+    for (size_t i = 0; i < size; i++) {
+        bool overridden = false;
+        for (size_t k = 0; k < count && !overridden; k++) {
+            size_t nameLen = strchr(assignments[k], '=') - assignments[k] + 1;
+            overridden = strncmp(envp[i], assignments[k], nameLen) == 0;
+        }
+        if (!overridden)
+            result[n++] = envp[i];
+    }
+    for (size_t k = 0; k < count; k++) {
+        result[n++] = assignments[k];
+    }
+    return result;
+}
 
-    for (size_t i = hndlrs->size - 1; i != -1; i--) {
-        kill(hndlrs->arr[i].pid, SIGQUIT);
-        close(hndlrs->arr[i].outputPipe[0]);
-        if (hndlrs->arr[i].inputFd != STDIN_FILENO)
-            close(hndlrs->arr[i].inputFd);
-        hndlrs->arr[i].pid = 0;
+/*
+ * Runs the builtin in the shell with its stdout at outputFd. Writes to a pipe whose reader has exited must not
+ * kill the shell, so SIGPIPE is blocked meanwhile and dropped afterwards.
+ */
+static int runBuiltin(BuiltinHandler builtin, Command *token, int inputFd, int outputFd, bool subshell) {
+    fflush(stdout);
+    BuiltinContext ctx = {
+            .out = stdout,
+            .inputFd = inputFd,
+            .subshell = subshell
+    };
+    if (outputFd != STDOUT_FILENO) {
+        ctx.out = fdopen(dup(outputFd), "w");
+        if (ctx.out == NULL) {
+            printf("%s: %s\n", token->name, strerror(errno));
+            return EXIT_FAILURE;
+        }
     }
 
-    char output[512] = {0};
-    ssize_t readRes;
-    int fd = hLast->outputPipe[0];
-    do {
-        fprintf(outFile, "%s", output);
-        readRes = read(fd, output, sizeof(output)-1);
-        output[readRes] = 0;
-    } while (readRes > 0);
+    sigset_t pipeSignal, oldMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipeSignal, &oldMask);
 
-    hndlrs->size = 0;
-    hLast->pid = 0;
+    int ret = builtin(token, &ctx);
+    if (ctx.out != stdout) {
+        fclose(ctx.out);
+    } else {
+        fflush(stdout);
+    }
 
+    struct timespec noWait = {0};
+    while (sigtimedwait(&pipeSignal, NULL, &noWait) > 0);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
     return ret;
 }
 
-static int syncPointProcStdout(HandlerArray *hndlrs) {
-    return syncPointProc(hndlrs, stdout);
+/* Builtin in the middle of a pipeline reads and writes pipes of other processes, so it gets its own process. */
+static int forkBuiltin(BuiltinHandler builtin, Command *token, HandlerArray *hndlrs, Handler *h, int outputFd) {
+    fflush(stdout);
+    h->pid = fork();
+    if (h->pid < 0) {
+        h->pid = 0;
+        return errno;
+    }
+    if (h->pid == 0) {
+        forkServerForget();
+        if (h->inputFd != STDIN_FILENO) {
+            dup2(h->inputFd, STDIN_FILENO);
+        }
+        if (outputFd != STDOUT_FILENO) {
+            dup2(outputFd, STDOUT_FILENO);
+        }
+        closeOtherStages(hndlrs, h);
+        BuiltinContext ctx = {
+                .out = stdout,
+                .inputFd = STDIN_FILENO,
+                .subshell = true
+        };
+        int ret = builtin(token, &ctx);
+        fflush(stdout);
+        _exit(ret);
+    }
+    return 0;
+}
+
+// Exit statuses of all stages of the last waited pipeline
+static int *pipeStatus = NULL;
+static size_t pipeStatusSize = 0;
+
+static int pidfdOpen(int pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+/* Reaps the process of the stage with its resource usage. */
+static void reapStage(Handler *h) {
+    int status = 0;
+    while (accountingWait(&h->usage, h->pid, &status, 0) < 0 && errno == EINTR);
+    h->status = decodeWaitStatus(status);
+    accountingTrace(&h->usage, h->pid, h->status);
+    h->pid = 0;
 }
 
-static int syncPointProcFile(HandlerArray *hndlrs, const char *fileName, bool isAppendMode) {
-    FILE *fd = fopen(fileName, isAppendMode ? "a" : "w");
-    int ret = syncPointProc(hndlrs, fd);
-    fflush(fd);
-    fclose(fd);
+/*
+ * Reaps every stage of the pipeline in the order they exit: each child gets a pidfd, which becomes readable
+ * when it exits. Stages without a pidfd (old kernel) are waited for in order afterwards.
+ */
+static void waitPipeline(HandlerArray *hndlrs) {
+    SMALL_VECTOR(struct pollfd, INLINE_PIPELINE_LEN) pidfds = {0};
+    if (!smallVectorReserve(&pidfds, hndlrs->stages.size)) {
+        printf("Failed to allocate pidfds\n");
+        exit(EXIT_FAILURE);
+    }
+    struct pollfd *fds = pidfds.data;
+    size_t polled = 0;
+    for (size_t i = 0; i < hndlrs->stages.size; i++) {
+        fds[i].fd = pidfdOpen(hndlrs->stages.data[i].pid);
+        fds[i].events = POLLIN;
+        if (fds[i].fd >= 0)
+            polled++;
+    }
+
+    while (polled > 0) {
+        if (poll(fds, hndlrs->stages.size, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (size_t i = 0; i < hndlrs->stages.size; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            reapStage(&hndlrs->stages.data[i]);
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            polled--;
+        }
+    }
+
+    for (size_t i = 0; i < hndlrs->stages.size; i++) {
+        if (hndlrs->stages.data[i].pid != 0) {
+            reapStage(&hndlrs->stages.data[i]);
+        }
+        if (fds[i].fd >= 0)
+            close(fds[i].fd);
+    }
+    smallVectorFree(&pidfds);
+}
+
+/* Waits for the whole pipeline and returns exit status of its last stage. */
+static int syncPoint(HandlerArray *hndlrs) {
+    if (hndlrs->stages.size == 0) {
+        pipeStatusSize = 0;
+        return 0;
+    }
+
+    Handler *hLast = &hndlrs->stages.data[hndlrs->stages.size - 1];
+    if (hLast->outputPipe[0] >= 0) {
+        close(hLast->outputPipe[0]);
+        hLast->outputPipe[0] = -1;
+    }
+    waitPipeline(hndlrs);
+
+    int *newStatus = (int *) realloc(pipeStatus, hndlrs->stages.size * sizeof(int));
+    if (newStatus != NULL) {
+        pipeStatus = newStatus;
+        pipeStatusSize = hndlrs->stages.size;
+        for (size_t i = 0; i < hndlrs->stages.size; i++) {
+            pipeStatus[i] = hndlrs->stages.data[i].status;
+        }
+    }
+
+    int ret = hLast->status;
+    hndlrs->stages.size = 0;
     return ret;
 }
 
-#define BUILTIN_CD "cd"
-static uint32_t executeBuiltin(Command *token) {
-    if (strcmp(token->name, BUILTIN_CD) == 0) {
-        int ret = 0;
-        if (token->argc < 1) {
-            ret = chdir("/");
+size_t executorPipeStatus(const int **statuses) {
+    *statuses = pipeStatus;
+    return pipeStatusSize;
+}
+
+// Exit status of the last foreground pipeline
+static int lastStatus = 0;
+
+static const char *operatorName(uint32_t type) {
+    switch (type) {
+        case COMMAND_TYPE_OPERATOR_AND:
+            return "&&";
+        case COMMAND_TYPE_OPERATOR_OR:
+            return "||";
+        case COMMAND_TYPE_OPERATOR_APPEND:
+            return ">>";
+        default:
+            return ">";
+    }
+}
+
+/* Writes the word with variable references shown as ${NAME} and substitutions as $(...), returns the end of it. */
+static char *describeWord(char *pos, const char *word) {
+    char opened = 0;
+    for (; *word != 0; word++) {
+        if (*word != VARS_MARKER && *word != VARS_COMMAND_MARKER) {
+            *pos++ = *word;
+        } else if (opened == 0) {
+            pos = stpcpy(pos, *word == VARS_MARKER ? "${" : "$(");
+            opened = *word;
         } else {
-            ret = chdir(token->argv[1]);
+            *pos++ = opened == VARS_MARKER ? '}' : ')';
+            opened = 0;
         }
-//        if (ret != 0) {
-//            printf("ERROR: %s\n", strerror(-ret));
-//        }
-        return EXIT_SUCCESS;
     }
-    return EXIT_FAILURE;
+    *pos = 0;
+    return pos;
 }
 
-size_t execute(CommandArray array) {
-    HandlerArray hndlrs = arrayInit();
-    size_t regularsExecuted = 0;
-
-    for (size_t i = 0; i < array.size; i++) {
-        Command *token = &array.tokens[i];
-        if (token->type == COMMAND_TYPE_COMMENT) {
-            break;
+/* Text of the and-or list, as shown by jobs. */
+static char *describeAndOr(AndOrList *andOr) {
+    size_t len = 1;
+    for (size_t p = 0; p < andOr->size; p++) {
+        Pipeline *pipeline = &andOr->pipelines[p];
+        for (size_t i = 0; i < pipeline->size; i++) {
+            Command *token = &pipeline->commands[i];
+            if (token->subshell != NULL)
+                len += strlen(token->subshell) + 2;
+            // Variable references take up to two more characters than their markers
+            for (size_t k = 0; k < token->argc; k++)
+                len += 2 * strlen(token->argv[k]) + 1;
+            for (size_t k = 0; k < token->redirectionCount; k++)
+                len += 2 * strlen(token->redirections[k].target) + 4;
+            len += 3;
         }
-        if (token->type == COMMAND_TYPE_REGULAR) {
-            uint32_t builtInError = executeBuiltin(token);
-            if (builtInError != EXIT_FAILURE) {
-                continue;
+        len += 4;
+    }
+
+    char *text = (char *) calloc(len, sizeof(char));
+    char *pos = text;
+    for (size_t p = 0; p < andOr->size; p++) {
+        Pipeline *pipeline = &andOr->pipelines[p];
+        if (p > 0)
+            pos += sprintf(pos, " %s ", operatorName(pipeline->connector));
+        for (size_t i = 0; i < pipeline->size; i++) {
+            Command *token = &pipeline->commands[i];
+            if (i > 0)
+                pos += sprintf(pos, " | ");
+            if (token->subshell != NULL)
+                pos += sprintf(pos, "(%s)", token->subshell);
+            for (size_t k = 0; k < token->argc; k++) {
+                if (k > 0)
+                    *pos++ = ' ';
+                pos = describeWord(pos, token->argv[k]);
             }
-            uint32_t ret = executeRegular(token, &hndlrs);
-            if (ret != EXIT_SUCCESS) {
-                printf("failed to execute\n");
-                break;
+            for (size_t k = 0; k < token->redirectionCount; k++) {
+                pos += sprintf(pos, " %s ", operatorName(token->redirections[k].type));
+                pos = describeWord(pos, token->redirections[k].target);
             }
-            regularsExecuted++;
-        } else if (token->type == COMMAND_TYPE_OPERATOR_PIPE) {
-            continue;
-        } else if (token->type == COMMAND_TYPE_OPERATOR_AND) {
-            int ret = syncPointProcStdout(&hndlrs);
-            if (ret != 0)
-                break;
-        } else if (token->type == COMMAND_TYPE_OPERATOR_OR) {
-            int ret = syncPointProcStdout(&hndlrs);
-            if (ret == 0)
-                break;
-        } else if (token->type == COMMAND_TYPE_OPERATOR_APPEND || token->type == COMMAND_TYPE_OPERATOR_WRITE) {
-            if (i + 1 >= array.size) {
-                printf("No target for write provided");
-                continue;
+        }
+    }
+    return text;
+}
+
+/*
+ * Starts every stage of the pipeline. Builtins of the first and the last stage run in the shell after the processes
+ * have started, so that the first one never blocks on a full pipe nobody reads yet. Only one of them can run in the
+ * shell, as each of them could wait for the other one: the first stage gets a process if the last one is a builtin.
+ */
+static void launchPipeline(Pipeline *pipeline, HandlerArray *hndlrs, size_t *regularsExecuted) {
+    size_t deferred[2];
+    int deferredOutput[2];
+    Command deferredCommand[2];
+    size_t deferredCount = 0;
+
+    // Commands referring to variables run expanded copies, the parsed ones stay intact for the next run
+    SMALL_VECTOR(Command, INLINE_PIPELINE_LEN) expanded = {0};
+    if (!smallVectorReserve(&expanded, pipeline->size)) {
+        printf("Failed to allocate expanded commands\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(expanded.data, 0, pipeline->size * sizeof(Command));
+    for (size_t i = 0; i < pipeline->size; i++) {
+        if (pipeline->commands[i].expand && !expandCommand(&pipeline->commands[i], &expanded.data[i])) {
+            printf("Failed to expand variables\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Command *lastToken = stageCommand(pipeline, expanded.data, pipeline->size - 1);
+    size_t lastAssignments = assignmentCount(lastToken);
+    bool lastIsBuiltin = lastToken->argc > lastAssignments && builtinFind(lastToken->argv[lastAssignments]) != NULL;
+
+    for (size_t i = 0; i < pipeline->size; i++) {
+        Command *token = stageCommand(pipeline, expanded.data, i);
+        bool last = i + 1 == pipeline->size;
+        int outputFd = openOutput(token);
+        Handler *h = addStage(hndlrs, !last);
+        if (hndlrs->timed)
+            accountingStart(&h->usage, stageName(token));
+        if (outputFd != -1 && token->subshell != NULL) {
+            int ret = forkSubshell(token, hndlrs, h, stageOutput(h, outputFd));
+            if (ret != 0) {
+                printf("Failed to start subshell: %s\n", strerror(ret));
+                h->status = EXIT_FAILURE;
             }
-            Command *newToken = &array.tokens[++i];
-            syncPointProcFile(&hndlrs, newToken->name, token->type == COMMAND_TYPE_OPERATOR_APPEND);
+            releaseStage(hndlrs, h, outputFd);
+            continue;
         }
+        size_t assignments = assignmentCount(token);
+        if (outputFd == -1 || token->argc == assignments) {
+            // Failed redirection, only redirections or only assignments, which take effect outside of pipelines
+            h->status = outputFd == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+            if (outputFd != -1 && token->argc > 0 && pipeline->size == 1)
+                h->status = assignVariables(token);
+            releaseStage(hndlrs, h, outputFd == -1 ? STDOUT_FILENO : outputFd);
+            continue;
+        }
+
+        // NAME=value words before the name go to the environment of the command only
+        Command command = *token;
+        command.argv += assignments;
+        command.argc -= assignments;
+        command.name = command.argv[0];
+        BuiltinHandler builtin = builtinFind(command.name);
+        if (builtin != NULL && (last || (i == 0 && !lastIsBuiltin))) {
+            deferred[deferredCount] = i;
+            deferredOutput[deferredCount] = outputFd;
+            deferredCommand[deferredCount] = command;
+            deferredCount++;
+            continue;
+        }
+        int ret;
+        if (builtin != NULL) {
+            ret = forkBuiltin(builtin, &command, hndlrs, h, stageOutput(h, outputFd));
+        } else if (assignments > 0) {
+            char **envp = commandEnvironment(token->argv, assignments);
+            ret = envp != NULL ? startProcess(&command, envp, h, stageOutput(h, outputFd)) : ENOMEM;
+            free(envp);
+        } else {
+            ret = startProcess(&command, varsEnvironment(), h, stageOutput(h, outputFd));
+        }
+        if (ret != 0) {
+            printf("Failed to start %s: %s\n", command.name, strerror(ret));
+            h->status = EXIT_FAILURE;
+        } else if (builtin == NULL) {
+            (*regularsExecuted)++;
+        }
+        releaseStage(hndlrs, h, outputFd);
     }
 
-    syncPointProcStdout(&hndlrs);
+    for (size_t k = 0; k < deferredCount; k++) {
+        size_t i = deferred[k];
+        Command *token = &deferredCommand[k];
+        Handler *h = &hndlrs->stages.data[i];
+        struct rusage before;
+        if (hndlrs->timed) {
+            getrusage(RUSAGE_SELF, &before);
+            accountingStart(&h->usage, token->name);
+        }
+        h->status = runBuiltin(builtinFind(token->name), token, h->inputFd,
+                               stageOutput(h, deferredOutput[k]), pipeline->size > 1);
+        if (hndlrs->timed)
+            accountingFinishSelf(&h->usage, &before);
+        releaseStage(hndlrs, h, deferredOutput[k]);
+    }
 
-    arrayFree(&hndlrs);
-    return regularsExecuted;
+    for (size_t i = 0; i < pipeline->size; i++) {
+        if (pipeline->commands[i].expand)
+            freeExpanded(&expanded.data[i]);
+    }
+    smallVectorFree(&expanded);
 }
 
-static bool resolvePath(const char *const name, char resolvedName[RESOLVED_NAME_MAX_LEN + 1]) {
-    char *path = getenv(PATH);
-    size_t pathLen = strlen(path);
+static bool hasTimePrefix(Pipeline *pipeline) {
+    Command *first = &pipeline->commands[0];
+    return first->argc > 0 && strcmp(first->argv[0], TIME_PREFIX) == 0;
+}
 
-    size_t startPos = 0;
-    while (startPos < pathLen){
-        size_t endPos = startPos;
-        while (endPos < pathLen && path[endPos] != ':') endPos++;
+/* Foreground pipeline: returns exit status of its last stage. */
+static int executePipeline(Pipeline *pipeline, size_t *regularsExecuted) {
+    HandlerArray hndlrs;
+    arrayInit(&hndlrs, STDIN_FILENO);
+    if (!hasTimePrefix(pipeline)) {
+        launchPipeline(pipeline, &hndlrs, regularsExecuted);
+        int status = syncPoint(&hndlrs);
+        arrayFree(&hndlrs);
+        return status;
+    }
 
-        char oldCh = path[endPos];
-        path[endPos] = 0;
+    // time: the pipeline runs without the prefix, then the times of it and of its stages go to stderr
+    SMALL_VECTOR(Command, INLINE_PIPELINE_LEN) commands = {0};
+    SMALL_VECTOR(const StageUsage *, INLINE_PIPELINE_LEN) usages = {0};
+    if (!smallVectorReserve(&commands, pipeline->size) || !smallVectorReserve(&usages, pipeline->size)) {
+        printf("Failed to allocate timed pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(commands.data, pipeline->commands, pipeline->size * sizeof(Command));
+    commands.data[0].argv++;
+    commands.data[0].argc--;
+    commands.data[0].name = commands.data[0].argv[0];
+    Pipeline timed = *pipeline;
+    timed.commands = commands.data;
 
-        char concatedName[RESOLVED_NAME_MAX_LEN] = {0};
-        sprintf(concatedName, "%s/%s", &path[startPos], name);
-        path[endPos] = oldCh;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    hndlrs.timed = true;
+    launchPipeline(&timed, &hndlrs, regularsExecuted);
+    size_t stages = hndlrs.stages.size;
+    int status = syncPoint(&hndlrs);
+    for (size_t i = 0; i < stages; i++) {
+        usages.data[i] = &hndlrs.stages.data[i].usage;
+    }
+    fflush(stdout);
+    accountingPrintTimes(stderr, &started, usages.data, stages);
+
+    arrayFree(&hndlrs);
+    smallVectorFree(&commands);
+    smallVectorFree(&usages);
+    return status;
+}
 
-        if (access(concatedName, X_OK) == EXIT_SUCCESS) {
-//            printf("Resolved using %s\n", concatedName);
-            strcpy(resolvedName, concatedName);
+/* Runs pipelines of the list, skipping the ones && and || say to skip. Returns status of the last one run. */
+static int executeAndOr(AndOrList *andOr, size_t *regularsExecuted) {
+    int status = lastStatus;
+    for (size_t p = 0; p < andOr->size; p++) {
+        Pipeline *pipeline = &andOr->pipelines[p];
+        if (p > 0 && pipeline->connector == COMMAND_TYPE_OPERATOR_AND && status != 0)
+            continue;
+        if (p > 0 && pipeline->connector == COMMAND_TYPE_OPERATOR_OR && status == 0)
+            continue;
+        status = lastStatus = executePipeline(pipeline, regularsExecuted);
+        varsSetLastStatus(lastStatus);
+        varsSetPipeStatus(pipeStatus, pipeStatusSize);
+    }
+    return status;
+}
+
+/* Some stage would run in the shell: a builtin, an assignment, or a name known only after expansion. */
+static bool runsInShell(Pipeline *pipeline) {
+    for (size_t i = 0; i < pipeline->size; i++) {
+        Command *token = &pipeline->commands[i];
+        if (token->subshell != NULL)
+            continue;
+        size_t assignments = assignmentCount(token);
+        if (token->expand || assignments == token->argc || builtinFind(token->argv[assignments]) != NULL)
             return true;
+    }
+    return false;
+}
+
+/*
+ * A list with && or || must be evaluated as a whole to run in background, so it gets a forked subshell,
+ * which runs it in foreground and exits with its status. So does a pipeline with the time prefix, which has to be
+ * waited for to be timed: the report is printed when it finishes, and one with builtins, which must neither block
+ * the shell nor change it. Any other pipeline is just not waited for.
+ */
+static void executeInBackground(AndOrList *andOr, size_t *regularsExecuted) {
+    char *command = describeAndOr(andOr);
+    Pipeline *pipeline = &andOr->pipelines[0];
+    if (andOr->size > 1 || hasTimePrefix(pipeline) || runsInShell(pipeline)) {
+        fflush(stdout);
+        int pid = fork();
+        if (pid < 0) {
+            printf("Failed to fork: %s\n", strerror(errno));
+            free(command);
+            return;
+        }
+        if (pid == 0) {
+            jobsForget();
+            forkServerForget();
+            int devNull = open("/dev/null", O_RDONLY);
+            dup2(devNull, STDIN_FILENO);
+            close(devNull);
+            size_t unused = 0;
+            int status = executeAndOr(andOr, &unused);
+            fflush(stdout);
+            exit(status);
         }
+        jobsAdd(&pid, 1, command);
+        free(command);
+        return;
+    }
+
+    HandlerArray hndlrs;
+    arrayInit(&hndlrs, open("/dev/null", O_RDONLY | O_CLOEXEC));
+    launchPipeline(&andOr->pipelines[0], &hndlrs, regularsExecuted);
+    close(hndlrs.inputFd);
+    if (hndlrs.stages.size > 0) {
+        int *pids = (int *) calloc(hndlrs.stages.size, sizeof(int));
+        size_t processes = 0;
+        for (size_t i = 0; i < hndlrs.stages.size; i++) {
+            if (hndlrs.stages.data[i].pid != 0)
+                pids[processes++] = hndlrs.stages.data[i].pid;
+        }
+        if (processes > 0)
+            jobsAdd(pids, processes, command);
+        free(pids);
+    }
+    arrayFree(&hndlrs);
+    free(command);
+}
+
+// Output of a parallel job which is not the oldest unfinished one, kept until all jobs before it are printed
+typedef struct {
+    SMALL_VECTOR(char, 1) buf;
+    bool finished;
+} ParallelOutput;
+
+#define PARALLEL_READ_CHUNK (64 * 1024)
+#define PARALLEL_PLACEHOLDER "{}"
+
+/* Arguments of the job: every {} in the command is replaced with the input, or it is appended if there are none. */
+static void parallelCommand(Command *job, char **command, size_t commandArgc, const char *input) {
+    job->argv = (char **) calloc(commandArgc + 2, sizeof(char *));
+    job->argc = 0;
+    bool replaced = false;
+    for (size_t i = 0; i < commandArgc; i++) {
+        const char *word = command[i];
+        size_t len = strlen(word) + 1;
+        for (const char *p = strstr(word, PARALLEL_PLACEHOLDER); p != NULL; p = strstr(p + 2, PARALLEL_PLACEHOLDER))
+            len += strlen(input);
+        char *arg = (char *) calloc(len, sizeof(char));
+        char *out = arg;
+        const char *p;
+        while ((p = strstr(word, PARALLEL_PLACEHOLDER)) != NULL) {
+            memcpy(out, word, p - word);
+            out += p - word;
+            out = stpcpy(out, input);
+            word = p + 2;
+            replaced = true;
+        }
+        strcpy(out, word);
+        job->argv[job->argc++] = arg;
+    }
+    if (!replaced) {
+        job->argv[job->argc++] = strdup(input);
+    }
+    job->name = job->argv[0];
+    job->redirections = NULL;
+    job->redirectionCount = 0;
+}
+
+static void freeParallelCommand(Command *job) {
+    for (size_t i = 0; i < job->argc; i++) {
+        free(job->argv[i]);
+    }
+    free(job->argv);
+}
+
+static bool writeOutput(FILE *out, const char *data, size_t len) {
+    if (len == 0)
+        return true;
+    bool ok = fwrite(data, 1, len, out) == len;
+    return fflush(out) == 0 && ok;
+}
+
+/* Finishes the job of the slot: its output is drained, so it has exited or is about to. Returns its status. */
+static int reapParallelSlot(HandlerArray *pool, size_t *slotJob, size_t slot) {
+    Handler *h = &pool->stages.data[slot];
+    close(h->outputPipe[0]);
+    reapStage(h);
+    int status = h->status;
+
+    size_t last = pool->stages.size - 1;
+    pool->stages.data[slot] = pool->stages.data[last];
+    slotJob[slot] = slotJob[last];
+    pool->stages.size--;
+    return status;
+}
+
+int executorRunParallel(char **command, size_t commandArgc, char **inputs, size_t inputCount, size_t jobs,
+                        FILE *out) {
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (size_t) cpus : 1;
+    }
+    HandlerArray pool;
+    arrayInit(&pool, open("/dev/null", O_RDONLY | O_CLOEXEC));
+    size_t *slotJob = (size_t *) calloc(jobs, sizeof(size_t));
+    struct pollfd *fds = (struct pollfd *) calloc(jobs, sizeof(struct pollfd));
+    ParallelOutput *outputs = (ParallelOutput *) calloc(inputCount, sizeof(ParallelOutput));
+    char *chunk = (char *) malloc(PARALLEL_READ_CHUNK);
+    size_t next = 0;
+    size_t printed = 0;
+    size_t failed = 0;
+    bool outputBroken = false;
+    fflush(out);
+
+    while (printed < inputCount && !outputBroken) {
+        while (next < inputCount && pool.stages.size < jobs) {
+            Handler *h = smallVectorPush(&pool.stages);
+            if (h == NULL || pipe2(h->outputPipe, O_CLOEXEC) != 0) {
+                printf("Failed to start %s: %s\n", command[0], h == NULL ? strerror(ENOMEM) : strerror(errno));
+                if (h != NULL)
+                    pool.stages.size--;
+                outputs[next].finished = true;
+                failed++;
+                next++;
+                continue;
+            }
+            h->inputFd = pool.inputFd;
+            h->status = EXIT_SUCCESS;
 
-        if (path[endPos] == 0) {
+            Command job;
+            parallelCommand(&job, command, commandArgc, inputs[next]);
+            if (pool.timed)
+                accountingStart(&h->usage, job.name);
+            int ret = startProcess(&job, varsEnvironment(), h, h->outputPipe[1]);
+            freeParallelCommand(&job);
+            close(h->outputPipe[1]);
+            h->outputPipe[1] = -1;
+            if (ret != 0) {
+                printf("Failed to start %s: %s\n", command[0], strerror(ret));
+                close(h->outputPipe[0]);
+                pool.stages.size--;
+                outputs[next].finished = true;
+                failed++;
+            } else {
+                slotJob[pool.stages.size - 1] = next;
+            }
+            next++;
+        }
+
+        for (size_t i = 0; i < pool.stages.size; i++) {
+            fds[i].fd = pool.stages.data[i].outputPipe[0];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (pool.stages.size > 0 && poll(fds, pool.stages.size, -1) < 0 && errno != EINTR)
             break;
+
+        // Slots are removed by swapping with the last one, so they are visited from the end
+        for (size_t i = pool.stages.size; i-- > 0;) {
+            if (fds[i].revents == 0)
+                continue;
+            size_t job = slotJob[i];
+            ssize_t got = read(pool.stages.data[i].outputPipe[0], chunk, PARALLEL_READ_CHUNK);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got > 0 && job == printed) {
+                outputBroken |= !writeOutput(out, chunk, got);
+            } else if (got > 0) {
+                ParallelOutput *o = &outputs[job];
+                if (!smallVectorReserve(&o->buf, o->buf.size + got)) {
+                    // Output of the job can't be kept whole, so the job is stopped and fails
+                    printf("Failed to allocate output of %s: %s\n", command[0], strerror(ENOMEM));
+                    kill(pool.stages.data[i].pid, SIGTERM);
+                    reapParallelSlot(&pool, slotJob, i);
+                    smallVectorFree(&o->buf);
+                    o->finished = true;
+                    failed++;
+                    continue;
+                }
+                memcpy(o->buf.data + o->buf.size, chunk, got);
+                o->buf.size += got;
+            } else {
+                failed += reapParallelSlot(&pool, slotJob, i) != 0;
+                outputs[job].finished = true;
+            }
+        }
+
+        // Oldest unfinished job streams its output directly, the ones finished after it wait for it
+        while (printed < inputCount && outputs[printed].finished) {
+            smallVectorFree(&outputs[printed].buf);
+            printed++;
+            if (printed < inputCount) {
+                outputBroken |= !writeOutput(out, outputs[printed].buf.data, outputs[printed].buf.size);
+                outputs[printed].buf.size = 0;
+            }
         }
-        startPos = endPos + 1;
     }
-    return false;
+
+    // Output is gone: the rest of the jobs are stopped
+    for (size_t i = 0; i < pool.stages.size; i++) {
+        kill(pool.stages.data[i].pid, SIGTERM);
+    }
+    while (pool.stages.size > 0) {
+        reapParallelSlot(&pool, slotJob, pool.stages.size - 1);
+    }
+    for (size_t i = 0; i < inputCount; i++) {
+        smallVectorFree(&outputs[i].buf);
+    }
+    close(pool.inputFd);
+    arrayFree(&pool);
+    free(chunk);
+    free(outputs);
+    free(fds);
+    free(slotJob);
+    return failed == 0 && !outputBroken ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+size_t execute(CommandList list) {
+    jobsReap();
+
+    size_t regularsExecuted = 0;
+    for (size_t i = 0; i < list.size; i++) {
+        if (list.lists[i].background) {
+            executeInBackground(&list.lists[i], &regularsExecuted);
+        } else {
+            executeAndOr(&list.lists[i], &regularsExecuted);
+        }
+    }
+    return regularsExecuted;
+}
+
+void executorPrepare(CommandList list) {
+    for (size_t i = 0; i < list.size; i++) {
+        for (size_t p = 0; p < list.lists[i].size; p++) {
+            Pipeline *pipeline = &list.lists[i].pipelines[p];
+            for (size_t k = 0; k < pipeline->size; k++) {
+                Command *token = &pipeline->commands[k];
+                // Names of commands referring to variables are known only when they run
+                if (token->argc > 0 && !token->expand && builtinFind(token->name) == NULL) {
+                    pathCacheLookup(token->name);
+                }
+            }
+        }
+    }
+}
+
+int executorLastStatus() {
+    return lastStatus;
+}
+
+int executorRunScript(char *text, size_t len) {
+    CommandScript script = parserParseScript(text, len);
+    for (size_t i = 0; i < script.size; i++) {
+        executorPrepare(script.lines[i]);
+    }
+    for (size_t i = 0; i < script.size; i++) {
+        execute(script.lines[i]);
+    }
+    parserFreeScript(&script);
+    return lastStatus;
 }
 
 #ifdef DEBUG
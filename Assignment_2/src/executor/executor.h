@@ -1,14 +1,34 @@
 #pragma once
 #include <stdint.h>
+#include <stdio.h>
 #include "parser.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define RESOLVED_NAME_MAX_LEN 128
-
-size_t execute(CommandArray array);
+size_t execute(CommandList list);
+// Resolves commands of the line in PATH ahead of execution, so that running it only hits the command hash table
+void executorPrepare(CommandList list);
+// Exit status of the last foreground pipeline
+int executorLastStatus();
+// Batch mode: parses the whole text in place, resolves its commands, then runs it. Returns the last status.
+int executorRunScript(char *text, size_t len);
+/*
+ * Runs the command once per input, at most jobs at a time (number of CPUs if 0), with {} in the command replaced with
+ * the input or the input appended. Output of every job is printed whole and in the order of inputs.
+ * Returns EXIT_FAILURE if any job has failed.
+ */
+int executorRunParallel(char **command, size_t commandArgc, char **inputs, size_t inputCount, size_t jobs,
+                        FILE *out);
+// Enlarges pipes between stages of pipelines with F_SETPIPE_SZ, fewer context switches for heavy pipelines
+void executorSetPipeSize(int bytes);
+// Starts the fork server, see forkserver.h. Must be called at startup, while the shell is small.
+bool executorStartForkServer();
+// Appends resource usage of every reaped child to the file, see accounting.h
+bool executorSetTraceLog(const char *path);
+// Exit statuses of every stage of the last finished pipeline, like PIPESTATUS of bash
+size_t executorPipeStatus(const int **statuses);
 
 #ifdef __cplusplus
 }
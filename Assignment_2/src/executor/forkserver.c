@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "forkserver.h"
+
+#define INITIAL_MESSAGE_SIZE 4096
+// stdin and stdout of the command and the current directory of the shell
+#define PASSED_FDS 3
+
+/* Request: the header, then path, argv and envp as null-terminated strings one after another. */
+typedef struct {
+    uint32_t argc;
+    uint32_t envc;
+} LaunchHeader;
+
+typedef struct {
+    int pid;
+    // errno of the failed launch, the child (if any) has exited then
+    int error;
+} LaunchReply;
+
+static int serverSocket = -1;
+
+static bool reserveMessage(char **buf, size_t *capacity, size_t required) {
+    if (required <= *capacity)
+        return true;
+    size_t newCapacity = *capacity == 0 ? INITIAL_MESSAGE_SIZE : *capacity;
+    while (newCapacity < required)
+        newCapacity *= 2;
+    char *newBuf = (char *) realloc(*buf, newCapacity);
+    if (newBuf == NULL)
+        return false;
+    *buf = newBuf;
+    *capacity = newCapacity;
+    return true;
+}
+
+/* Splits count strings of the message into a null-terminated array. */
+static char **unpackStrings(char **pos, const char *end, uint32_t count) {
+    char **strings = (char **) calloc(count + 1, sizeof(char *));
+    if (strings == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t len = strnlen(*pos, end - *pos);
+        if (*pos + len >= end) {
+            free(strings);
+            return NULL;
+        }
+        strings[i] = *pos;
+        *pos += len + 1;
+    }
+    return strings;
+}
+
+/*
+ * Clones the child as a sibling of the helper, so the shell is its parent. A close-on-exec pipe tells whether exec
+ * has succeeded: it is closed by exec, or gets errno if exec fails.
+ */
+static LaunchReply launch(const char *path, char **argv, char **envp, const int *fds) {
+    LaunchReply reply = {0};
+    int errorPipe[2];
+    if (pipe2(errorPipe, O_CLOEXEC) != 0) {
+        reply.error = errno;
+        return reply;
+    }
+    long pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    if (pid < 0) {
+        reply.error = errno;
+        close(errorPipe[0]);
+        close(errorPipe[1]);
+        return reply;
+    }
+    if (pid == 0) {
+        close(errorPipe[0]);
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+        if (fds[0] != STDIN_FILENO)
+            dup2(fds[0], STDIN_FILENO);
+        if (fds[1] != STDOUT_FILENO)
+            dup2(fds[1], STDOUT_FILENO);
+        if (fchdir(fds[2]) == 0)
+            execve(path, argv, envp);
+        int error = errno;
+        while (write(errorPipe[1], &error, sizeof(error)) < 0 && errno == EINTR);
+        _exit(127);
+    }
+    close(errorPipe[1]);
+    reply.pid = (int) pid;
+    int error = 0;
+    ssize_t got;
+    while ((got = read(errorPipe[0], &error, sizeof(error))) < 0 && errno == EINTR);
+    if (got == sizeof(error))
+        reply.error = error;
+    close(errorPipe[0]);
+    return reply;
+}
+
+/* Body of the helper: serves requests until the shell closes its end of the socket. */
+static void serve(int sock) {
+    char *buf = NULL;
+    size_t capacity = 0;
+    char control[CMSG_SPACE(PASSED_FDS * sizeof(int))];
+
+    while (true) {
+        ssize_t len = recv(sock, NULL, 0, MSG_PEEK | MSG_TRUNC);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0 || !reserveMessage(&buf, &capacity, len + 1))
+            _exit(EXIT_SUCCESS);
+
+        struct iovec iov = {.iov_base = buf, .iov_len = capacity};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (len <= 0)
+            _exit(EXIT_SUCCESS);
+
+        int fds[PASSED_FDS] = {-1, -1, -1};
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+
+        LaunchReply reply = {.error = EINVAL};
+        LaunchHeader header;
+        if ((size_t) len > sizeof(header) && fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0) {
+            memcpy(&header, buf, sizeof(header));
+            char *pos = buf + sizeof(header);
+            char *end = buf + len;
+            const char *path = pos;
+            pos += strnlen(pos, end - pos) + 1;
+            char **argv = pos < end ? unpackStrings(&pos, end, header.argc) : NULL;
+            char **envp = argv != NULL ? unpackStrings(&pos, end, header.envc) : NULL;
+            if (envp != NULL)
+                reply = launch(path, argv, envp, fds);
+            free(argv);
+            free(envp);
+        }
+        for (size_t i = 0; i < PASSED_FDS; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+        while (send(sock, &reply, sizeof(reply), 0) < 0 && errno == EINTR);
+    }
+}
+
+bool forkServerStart() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0) {
+        printf("Failed to start fork server: %s\n", strerror(errno));
+        return false;
+    }
+    fflush(stdout);
+    int pid = fork();
+    if (pid < 0) {
+        printf("Failed to start fork server: %s\n", strerror(errno));
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        serve(sockets[1]);
+    }
+    close(sockets[1]);
+    serverSocket = sockets[0];
+    return true;
+}
+
+bool forkServerRunning() {
+    return serverSocket >= 0;
+}
+
+void forkServerForget() {
+    if (serverSocket >= 0) {
+        close(serverSocket);
+        serverSocket = -1;
+    }
+}
+
+static bool packString(char **buf, size_t *capacity, size_t *len, const char *s) {
+    size_t n = strlen(s) + 1;
+    if (!reserveMessage(buf, capacity, *len + n))
+        return false;
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    return true;
+}
+
+int forkServerSpawn(const char *path, char *const *argv, char *const *envp, int inputFd, int outputFd, int *pid) {
+    // Reused by every launch
+    static char *buf = NULL;
+    static size_t capacity = 0;
+
+    LaunchHeader header = {0};
+    size_t len = sizeof(header);
+    bool packed = reserveMessage(&buf, &capacity, len) && packString(&buf, &capacity, &len, path);
+    for (; packed && argv[header.argc] != NULL; header.argc++)
+        packed = packString(&buf, &capacity, &len, argv[header.argc]);
+    for (; packed && envp[header.envc] != NULL; header.envc++)
+        packed = packString(&buf, &capacity, &len, envp[header.envc]);
+    if (!packed)
+        return ENOMEM;
+    memcpy(buf, &header, sizeof(header));
+
+    // The helper stays where the shell was started, the child goes to the directory of the shell
+    int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0)
+        return errno;
+    int fds[PASSED_FDS] = {inputFd, outputFd, cwd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t ret;
+    while ((ret = sendmsg(serverSocket, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    close(cwd);
+    if (ret < 0) {
+        int error = errno;
+        // The helper is gone, commands are launched by the shell from now on
+        if (error != EMSGSIZE)
+            forkServerForget();
+        return error;
+    }
+
+    LaunchReply reply;
+    while ((ret = recv(serverSocket, &reply, sizeof(reply), 0)) < 0 && errno == EINTR);
+    if (ret != sizeof(reply)) {
+        forkServerForget();
+        return EPIPE;
+    }
+    if (reply.error != 0) {
+        if (reply.pid > 0) {
+            // Exec has failed, the child is ours to reap
+            while (waitpid(reply.pid, NULL, 0) < 0 && errno == EINTR);
+        }
+        return reply.error;
+    }
+    *pid = reply.pid;
+    return 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fork server: a helper forked from the shell at startup, while the shell is still small. It gets launch requests
+ * over a Unix socket (path, argv and envp in the message, stdin, stdout and the current directory as SCM_RIGHTS)
+ * and clones children with CLONE_PARENT, so they are children of the shell, which waits for them as usual, and the
+ * cost of a launch doesn't depend on the size of the shell.
+ */
+
+// Starts the helper. Returns false if it can't be started, commands are launched by the shell then.
+bool forkServerStart();
+bool forkServerRunning();
+// Forked shells must not use the helper: children it starts would be children of the main shell
+void forkServerForget();
+// Starts the program with stdin and stdout at the fds. Returns 0 or errno, like posix_spawn.
+int forkServerSpawn(const char *path, char *const *argv, char *const *envp, int inputFd, int outputFd, int *pid);
+
+#ifdef __cplusplus
+}
+#endif
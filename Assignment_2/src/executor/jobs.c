@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <wait.h>
+#include "jobs.h"
+
+#define INITIAL_JOBS_CAPACITY 8
+// Statuses of that many finished jobs are kept for wait after the jobs are dropped from the table
+#define FINISHED_JOBS_KEPT 64
+
+typedef struct {
+    int id;
+    char *command;
+    int *pids;
+    size_t pidCount;
+    size_t running;
+    // Exit status of the last process of the job
+    int status;
+} Job;
+
+typedef struct {
+    Job *arr;
+    size_t size;
+    size_t capacity;
+} JobTable;
+
+static JobTable jobs = {0};
+
+typedef struct {
+    int id;
+    int status;
+} FinishedJob;
+
+// Ring of finished jobs nobody has waited for, the oldest ones are overwritten
+static FinishedJob finished[FINISHED_JOBS_KEPT];
+static size_t finishedNext = 0;
+static volatile sig_atomic_t childExited = 0;
+
+static void sigchldHandler(int sig) {
+    (void) sig;
+    childExited = 1;
+}
+
+static void installSigchldHandler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchldHandler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+int decodeWaitStatus(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void removeJob(size_t i) {
+    free(jobs.arr[i].command);
+    free(jobs.arr[i].pids);
+    memmove(&jobs.arr[i], &jobs.arr[i + 1], (jobs.size - i - 1) * sizeof(Job));
+    jobs.size--;
+}
+
+int jobsAdd(const int *pids, size_t count, const char *command) {
+    static bool handlerInstalled = false;
+    if (!handlerInstalled) {
+        installSigchldHandler();
+        handlerInstalled = true;
+    }
+    if (jobs.size == jobs.capacity) {
+        size_t newCapacity = jobs.capacity == 0 ? INITIAL_JOBS_CAPACITY : jobs.capacity * 2;
+        Job *newArr = (Job *) realloc(jobs.arr, newCapacity * sizeof(Job));
+        if (newArr == NULL) {
+            printf("Failed to extend job table\n");
+            return 0;
+        }
+        jobs.arr = newArr;
+        jobs.capacity = newCapacity;
+    }
+
+    Job *job = &jobs.arr[jobs.size];
+    job->id = jobs.size > 0 ? jobs.arr[jobs.size - 1].id + 1 : 1;
+    // Ids are reused once the table is empty, the status of an old job with the same id is not waited for anymore
+    for (size_t i = 0; i < FINISHED_JOBS_KEPT; i++) {
+        if (finished[i].id == job->id)
+            finished[i].id = 0;
+    }
+    job->command = strdup(command);
+    job->pids = (int *) calloc(count, sizeof(int));
+    memcpy(job->pids, pids, count * sizeof(int));
+    job->pidCount = count;
+    job->running = count;
+    job->status = 0;
+    jobs.size++;
+    // The job could finish before the handler was installed
+    childExited = 1;
+
+    if (isatty(STDIN_FILENO)) {
+        printf("[%d] %d\n", job->id, pids[count - 1]);
+    }
+    return job->id;
+}
+
+/* Reaps children of the job, blocking or not. Returns true if all of them have finished. */
+static bool reapJob(Job *job, int options) {
+    for (size_t i = 0; i < job->pidCount; i++) {
+        if (job->pids[i] == 0)
+            continue;
+        int status = 0;
+        int ret = waitpid(job->pids[i], &status, options);
+        if (ret < 0 && errno == EINTR) {
+            i--;
+            continue;
+        }
+        if (ret == 0)
+            continue;
+        if (ret > 0 && i == job->pidCount - 1) {
+            job->status = decodeWaitStatus(status);
+        }
+        job->pids[i] = 0;
+        job->running--;
+    }
+    return job->running == 0;
+}
+
+void jobsReap() {
+    if (!childExited)
+        return;
+    childExited = 0;
+
+    bool interactive = isatty(STDIN_FILENO);
+    for (size_t i = 0; i < jobs.size; i++) {
+        if (!reapJob(&jobs.arr[i], WNOHANG))
+            continue;
+        if (interactive) {
+            printf("[%d]  Done\t\t%s\n", jobs.arr[i].id, jobs.arr[i].command);
+        }
+        // Scripts may start any number of jobs, only the status of a finished one is kept for wait
+        finished[finishedNext].id = jobs.arr[i].id;
+        finished[finishedNext].status = jobs.arr[i].status;
+        finishedNext = (finishedNext + 1) % FINISHED_JOBS_KEPT;
+        removeJob(i--);
+    }
+}
+
+void jobsForget() {
+    while (jobs.size > 0) {
+        removeJob(jobs.size - 1);
+    }
+    memset(finished, 0, sizeof(finished));
+}
+
+int jobsParseId(const char *arg) {
+    if (arg[0] == '%')
+        arg++;
+    char *end = NULL;
+    long id = strtol(arg, &end, 10);
+    if (end == arg || *end != 0 || id <= 0 || id > INT_MAX)
+        return -1;
+    return (int) id;
+}
+
+static Job *findJob(int id, size_t *index) {
+    for (size_t i = 0; i < jobs.size; i++) {
+        if (jobs.arr[i].id == id) {
+            *index = i;
+            return &jobs.arr[i];
+        }
+    }
+    return NULL;
+}
+
+void jobsPrint(FILE *out) {
+    childExited = 1;
+    jobsReap();
+    for (size_t i = 0; i < jobs.size; i++) {
+        Job *job = &jobs.arr[i];
+        fprintf(out, "[%d]  %s\t\t%s\n", job->id, job->running > 0 ? "Running" : "Done", job->command);
+        if (job->running == 0) {
+            removeJob(i--);
+        }
+    }
+}
+
+int jobsWait(int id) {
+    if (id == 0) {
+        int status = 0;
+        while (jobs.size > 0) {
+            reapJob(&jobs.arr[0], 0);
+            status = jobs.arr[0].status;
+            removeJob(0);
+        }
+        memset(finished, 0, sizeof(finished));
+        return status;
+    }
+
+    size_t index;
+    Job *job = findJob(id, &index);
+    for (size_t i = 0; job == NULL && i < FINISHED_JOBS_KEPT; i++) {
+        if (finished[i].id == id) {
+            finished[i].id = 0;
+            return finished[i].status;
+        }
+    }
+    if (job == NULL) {
+        printf("wait: %%%d: no such job\n", id);
+        return 127;
+    }
+    reapJob(job, 0);
+    int status = job->status;
+    removeJob(index);
+    return status;
+}
+
+int jobsForeground(int id) {
+    if (jobs.size == 0) {
+        printf("fg: no current job\n");
+        return 1;
+    }
+    size_t index = jobs.size - 1;
+    Job *job = id == 0 ? &jobs.arr[index] : findJob(id, &index);
+    if (job == NULL) {
+        printf("fg: %%%d: no such job\n", id);
+        return 1;
+    }
+    printf("%s\n", job->command);
+    fflush(stdout);
+    return jobsWait(job->id);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdio.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Table of background jobs. Children of jobs are reaped without blocking at safe points (before each
+ * command line and by the builtins below) after SIGCHLD has been received, so the shell never waits for them
+ * unless asked to.
+ */
+
+// Exit status of a child like bash reports it: exit code or 128 + signal number
+int decodeWaitStatus(int status);
+// Registers started processes as a job and returns its id
+int jobsAdd(const int *pids, size_t count, const char *command);
+// Reaps finished children of jobs without blocking and drops finished jobs. Interactive shell reports them.
+void jobsReap();
+// Forgets all jobs, used by forked subshells, which are not parents of them
+void jobsForget();
+
+// Parses job reference: %n or n. Returns -1 if the argument is not a job reference.
+int jobsParseId(const char *arg);
+// jobs: prints all jobs, finished ones are removed after that
+void jobsPrint(FILE *out);
+// wait: waits for the job, or all jobs if id is 0. Returns exit status of the last waited job, 127 if no such job.
+// A job which has finished and was dropped from the table is still found among the last finished ones.
+int jobsWait(int id);
+// fg: prints command of the job (the most recent one if id is 0) and waits for it
+int jobsForeground(int id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "pathcache.h"
+#include "vars.h"
+
+#define PATH "PATH"
+#define INITIAL_CACHE_CAPACITY 64
+// Table is grown when it is filled more than by MAX_LOAD_NUM / MAX_LOAD_DEN
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 10
+
+typedef struct {
+    char *name;
+    char *path;
+} PathCacheEntry;
+
+typedef struct {
+    PathCacheEntry *entries;
+    size_t capacity;
+    size_t size;
+    // Value of PATH the entries were resolved with
+    char *pathEnv;
+} PathCache;
+
+static PathCache cache = {0};
+
+static uint64_t hashName(const char *name) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name != 0; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static PathCacheEntry *findSlot(PathCacheEntry *entries, size_t capacity, const char *name) {
+    size_t i = hashName(name) & (capacity - 1);
+    while (entries[i].name != NULL && strcmp(entries[i].name, name) != 0) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+static void growCache() {
+    size_t newCapacity = cache.capacity == 0 ? INITIAL_CACHE_CAPACITY : cache.capacity * 2;
+    PathCacheEntry *newEntries = (PathCacheEntry *) calloc(newCapacity, sizeof(PathCacheEntry));
+    if (newEntries == NULL) {
+        printf("Failed to allocate command hash table\n");
+        return;
+    }
+    for (size_t i = 0; i < cache.capacity; i++) {
+        if (cache.entries[i].name != NULL) {
+            *findSlot(newEntries, newCapacity, cache.entries[i].name) = cache.entries[i];
+        }
+    }
+    free(cache.entries);
+    cache.entries = newEntries;
+    cache.capacity = newCapacity;
+}
+
+/* Returns the remembered path, or a copy valid until the next lookup if there is no memory to remember it. */
+static const char *insert(const char *name, const char *path) {
+    static char uncached[PATH_MAX];
+    if ((cache.size + 1) * MAX_LOAD_DEN > cache.capacity * MAX_LOAD_NUM) {
+        growCache();
+    }
+    // The table could not grow: the command is looked up in PATH every time then
+    if (cache.size + 1 >= cache.capacity) {
+        snprintf(uncached, sizeof(uncached), "%s", path);
+        return uncached;
+    }
+    PathCacheEntry *e = findSlot(cache.entries, cache.capacity, name);
+    if (e->name == NULL) {
+        char *nameCopy = strdup(name);
+        char *pathCopy = strdup(path);
+        if (nameCopy == NULL || pathCopy == NULL) {
+            free(nameCopy);
+            free(pathCopy);
+            snprintf(uncached, sizeof(uncached), "%s", path);
+            return uncached;
+        }
+        e->name = nameCopy;
+        e->path = pathCopy;
+        cache.size++;
+    }
+    return e->path;
+}
+
+void pathCacheClear() {
+    for (size_t i = 0; i < cache.capacity; i++) {
+        free(cache.entries[i].name);
+        free(cache.entries[i].path);
+    }
+    free(cache.entries);
+    free(cache.pathEnv);
+    cache.entries = NULL;
+    cache.capacity = 0;
+    cache.size = 0;
+    cache.pathEnv = NULL;
+}
+
+/* Drops the cache if PATH has changed since it was filled. Returns current PATH. */
+static const char *validate() {
+    const char *path = varsGet(PATH);
+    if (path == NULL) {
+        path = "";
+    }
+    if (cache.pathEnv == NULL || strcmp(cache.pathEnv, path) != 0) {
+        pathCacheClear();
+        cache.pathEnv = strdup(path);
+    }
+    return path;
+}
+
+/* Calls f for each directory of PATH, until it returns true. */
+static bool forEachPathDir(const char *path, bool (*f)(const char *dir, size_t dirLen, void *ctx), void *ctx) {
+    const char *start = path;
+    while (true) {
+        const char *end = strchr(start, ':');
+        size_t len = end != NULL ? (size_t) (end - start) : strlen(start);
+        // Empty entry means current directory
+        if (len == 0 ? f(".", 1, ctx) : f(start, len, ctx)) {
+            return true;
+        }
+        if (end == NULL) {
+            return false;
+        }
+        start = end + 1;
+    }
+}
+
+typedef struct {
+    const char *name;
+    char resolved[PATH_MAX];
+} ResolveContext;
+
+static bool tryDir(const char *dir, size_t dirLen, void *context) {
+    ResolveContext *ctx = (ResolveContext *) context;
+    int written = snprintf(ctx->resolved, sizeof(ctx->resolved), "%.*s/%s", (int) dirLen, dir, ctx->name);
+    if (written < 0 || (size_t) written >= sizeof(ctx->resolved)) {
+        return false;
+    }
+    return access(ctx->resolved, X_OK) == EXIT_SUCCESS;
+}
+
+const char *pathCacheLookup(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return access(name, X_OK) == EXIT_SUCCESS ? name : NULL;
+    }
+
+    const char *path = validate();
+    if (cache.capacity > 0) {
+        PathCacheEntry *e = findSlot(cache.entries, cache.capacity, name);
+        if (e->name != NULL) {
+            return e->path;
+        }
+    }
+
+    ResolveContext ctx = {.name = name};
+    if (!forEachPathDir(path, tryDir, &ctx)) {
+        return NULL;
+    }
+    return insert(name, ctx.resolved);
+}
+
+static bool scanDir(const char *dir, size_t dirLen, void *context) {
+    (void) context;
+    char dirName[PATH_MAX];
+    char fullName[PATH_MAX];
+    snprintf(dirName, sizeof(dirName), "%.*s", (int) dirLen, dir);
+
+    DIR *d = opendir(dirName);
+    if (d == NULL) {
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (cache.capacity > 0 && findSlot(cache.entries, cache.capacity, entry->d_name)->name != NULL) {
+            continue;
+        }
+        int written = snprintf(fullName, sizeof(fullName), "%s/%s", dirName, entry->d_name);
+        if (written < 0 || (size_t) written >= sizeof(fullName)) {
+            continue;
+        }
+        if (access(fullName, X_OK) == EXIT_SUCCESS) {
+            insert(entry->d_name, fullName);
+        }
+    }
+    closedir(d);
+    return false;
+}
+
+void pathCacheScan() {
+    const char *path = validate();
+    forEachPathDir(path, scanDir, NULL);
+}
+
+void pathCachePrint(FILE *out) {
+    validate();
+    for (size_t i = 0; i < cache.capacity; i++) {
+        if (cache.entries[i].name != NULL) {
+            fprintf(out, "%s\t%s\n", cache.entries[i].name, cache.entries[i].path);
+        }
+    }
+}
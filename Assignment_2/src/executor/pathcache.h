@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Command hash table, like the one of bash: name -> resolved executable path.
+ * Filled on first lookup of a name and dropped as a whole once PATH changes.
+ */
+
+// Returns resolved path, owned by the cache, or NULL if the command is not found.
+// Names with a slash are not looked up in PATH.
+const char *pathCacheLookup(const char *name);
+// Forgets all remembered commands (hash -r)
+void pathCacheClear();
+// Remembers every executable from PATH directories at once, earlier directories win
+void pathCacheScan();
+void pathCachePrint(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "relay.h"
+
+// Fits into the default pipe capacity, so a whole chunk is always duplicated into the scratch pipe at once
+#define RELAY_CHUNK (64 * 1024)
+
+static int writeAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/* Moves exactly len bytes from the pipe to fd, copying through userspace only if fd doesn't support splice. */
+static int spliceAll(int pipeFd, int fd, size_t len) {
+    while (len > 0) {
+        ssize_t moved = splice(pipeFd, NULL, fd, NULL, len, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR)
+            continue;
+        if (moved < 0 && errno == EINVAL) {
+            char buf[RELAY_CHUNK];
+            ssize_t got = read(pipeFd, buf, len < sizeof(buf) ? len : sizeof(buf));
+            if (got <= 0)
+                return got < 0 ? errno : EPIPE;
+            int ret = writeAll(fd, buf, got);
+            if (ret != 0)
+                return ret;
+            len -= got;
+            continue;
+        }
+        if (moved <= 0)
+            return moved < 0 ? errno : EPIPE;
+        len -= moved;
+    }
+    return 0;
+}
+
+/* Input which is not a pipe can't be teed, so it is copied through a buffer. */
+static int copyRelay(int inputFd, int outputFd, const int *files, size_t fileCount) {
+    char *buf = (char *) malloc(RELAY_CHUNK);
+    int ret = 0;
+    while (ret == 0) {
+        ssize_t got = read(inputFd, buf, RELAY_CHUNK);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            ret = got < 0 ? errno : 0;
+            break;
+        }
+        for (size_t i = 0; i < fileCount && ret == 0; i++) {
+            ret = writeAll(files[i], buf, got);
+        }
+        if (ret == 0)
+            ret = writeAll(outputFd, buf, got);
+    }
+    free(buf);
+    return ret;
+}
+
+int relayTee(int inputFd, int outputFd, const int *files, size_t fileCount) {
+    if (fileCount == 0) {
+        while (true) {
+            ssize_t moved = splice(inputFd, NULL, outputFd, NULL, RELAY_CHUNK, SPLICE_F_MOVE);
+            if (moved < 0 && errno == EINTR)
+                continue;
+            if (moved < 0 && errno == EINVAL)
+                return copyRelay(inputFd, outputFd, files, fileCount);
+            if (moved <= 0)
+                return moved < 0 ? errno : 0;
+        }
+    }
+
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) != 0)
+        return errno;
+
+    int ret = 0;
+    while (ret == 0) {
+        // The pending data is duplicated for every file without consuming it, then it is consumed to the output
+        ssize_t available = RELAY_CHUNK;
+        for (size_t i = 0; i < fileCount && ret == 0; i++) {
+            ssize_t copied;
+            while ((copied = tee(inputFd, scratch[1], available, 0)) < 0 && errno == EINTR);
+            if (copied <= 0) {
+                ret = copied < 0 ? errno : 0;
+                available = 0;
+                break;
+            }
+            available = copied;
+            ret = spliceAll(scratch[0], files[i], copied);
+        }
+        if (ret == EINVAL) {
+            // Not a pipe, nothing has been teed yet
+            ret = copyRelay(inputFd, outputFd, files, fileCount);
+            break;
+        }
+        if (ret != 0 || available == 0)
+            break;
+        ret = spliceAll(inputFd, outputFd, available);
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+    return ret;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Relays everything from inputFd to outputFd and a copy of it to every one of files, like tee(1) does.
+ * When the input is a pipe, data is duplicated with tee(2) and moved with splice(2), so it never gets to userspace.
+ * Returns 0 on success or errno of the first failure.
+ */
+int relayTee(int inputFd, int outputFd, const int *files, size_t fileCount);
+
+#ifdef __cplusplus
+}
+#endif
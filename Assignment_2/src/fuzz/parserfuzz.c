@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "parser.h"
+#include "vars.h"
+
+/*
+ * Fuzz harness of the tokenizer. parserTokenizeBuffer works in place and moves words with references to the words
+ * buffer on the fly; it is compared against a reference tokenizer below, which follows the same rules in the plainest
+ * way: one character at a time, copying every word to its own buffer.
+ *
+ * Standalone: random command lines from a small grammar, then throughput of both tokenizers on a generated corpus.
+ * With -DPARSER_FUZZ_LIBFUZZER the file is a libFuzzer target instead, which aborts on the first mismatch.
+ */
+
+typedef struct {
+    uint32_t type;
+    // Offset of the text in out, for words and subshells
+    size_t offset;
+    bool hasText;
+} RefToken;
+
+typedef struct {
+    const char *text;
+    char *out;
+    size_t outLen;
+    size_t outCapacity;
+    RefToken *tokens;
+    size_t count;
+    size_t capacity;
+    bool unterminated;
+} Reference;
+
+static void *grow(void *data, size_t *capacity, size_t required, size_t elementSize) {
+    if (required <= *capacity)
+        return data;
+    size_t newCapacity = *capacity == 0 ? 64 : *capacity;
+    while (newCapacity < required)
+        newCapacity *= 2;
+    data = realloc(data, newCapacity * elementSize);
+    if (data == NULL) {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = newCapacity;
+    return data;
+}
+
+static void put(Reference *ref, char ch) {
+    ref->out = (char *) grow(ref->out, &ref->outCapacity, ref->outLen + 1, sizeof(char));
+    ref->out[ref->outLen++] = ch;
+}
+
+static void pushToken(Reference *ref, uint32_t type, size_t offset, bool hasText) {
+    ref->tokens = (RefToken *) grow(ref->tokens, &ref->capacity, ref->count + 1, sizeof(RefToken));
+    ref->tokens[ref->count++] = (RefToken) {.type = type, .offset = offset, .hasText = hasText};
+}
+
+static bool refIsOperator(char ch) {
+    return ch == '|' || ch == '&' || ch == '>';
+}
+
+static bool refIsNameStart(char ch) {
+    return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+static bool refIsNameChar(char ch) {
+    return refIsNameStart(ch) || (ch >= '0' && ch <= '9');
+}
+
+static uint32_t refOperator(const char *op, size_t len) {
+    static const struct {
+        const char *text;
+        uint32_t type;
+    } operators[] = {
+        {"|", COMMAND_TYPE_OPERATOR_PIPE},
+        {">", COMMAND_TYPE_OPERATOR_WRITE},
+        {"&", COMMAND_TYPE_BACKGROUND},
+        {"||", COMMAND_TYPE_OPERATOR_OR},
+        {">>", COMMAND_TYPE_OPERATOR_APPEND},
+        {"&&", COMMAND_TYPE_OPERATOR_AND},
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (strlen(operators[i].text) == len && strncmp(operators[i].text, op, len) == 0)
+            return operators[i].type;
+    }
+    return COMMAND_TYPE_UNKNOWN;
+}
+
+/* Position of the parenthesis closing the one before pos, or of the end of the text */
+static size_t refClosingParen(Reference *ref, size_t pos) {
+    int depth = 1;
+    char quote = 0;
+    for (;; pos++) {
+        char ch = ref->text[pos];
+        if (ch == 0) {
+            ref->unterminated = true;
+            return pos;
+        }
+        if (quote == '\'') {
+            if (ch == '\'')
+                quote = 0;
+        } else if (ch == '\\') {
+            if (ref->text[pos + 1] != 0)
+                pos++;
+        } else if (quote == '"') {
+            if (ch == '"')
+                quote = 0;
+        } else if (ch == '\'' || ch == '"') {
+            quote = ch;
+        } else if (ch == '(') {
+            depth++;
+        } else if (ch == ')' && --depth == 0) {
+            return pos;
+        }
+    }
+}
+
+/* Length of the reference after '$': NAME, {NAME}, ? or $, 0 if there is none */
+static size_t refReference(const char *text, const char **name, size_t *nameLen) {
+    if (text[0] == '?' || text[0] == '$') {
+        *name = text;
+        *nameLen = 1;
+        return 1;
+    }
+    if (text[0] == '{') {
+        size_t len = 0;
+        while (text[1 + len] != 0 && text[1 + len] != '}')
+            len++;
+        if (text[1 + len] != '}' || len == 0 || !refIsNameStart(text[1]))
+            return 0;
+        for (size_t i = 0; i < len; i++) {
+            if (!refIsNameChar(text[1 + i]))
+                return 0;
+        }
+        *name = text + 1;
+        *nameLen = len;
+        return len + 2;
+    }
+    if (!refIsNameStart(text[0]))
+        return 0;
+    size_t len = 1;
+    while (refIsNameChar(text[len]))
+        len++;
+    *name = text;
+    *nameLen = len;
+    return len;
+}
+
+/* Copies the word at *pos to out without its quotes. Returns false if it is empty and was not quoted. */
+static bool refWord(Reference *ref, size_t *pos) {
+    const char *text = ref->text;
+    size_t r = *pos;
+    size_t start = ref->outLen;
+    char quote = 0;
+    bool quoted = false;
+
+    while (true) {
+        char ch = text[r];
+        if (ch == 0) {
+            if (quote != 0)
+                ref->unterminated = true;
+            break;
+        }
+        if (quote == '\'') {
+            if (ch != '\'')
+                put(ref, ch);
+            else
+                quote = 0;
+            r++;
+            continue;
+        }
+        if (ch == '\\') {
+            char next = text[r + 1];
+            if (next == '\n') {
+                r += 2;
+                if (text[r] == 0)
+                    ref->unterminated = true;
+            } else if (next == 0) {
+                r++;
+            } else if (quote == '"' && strchr("\"\\$`\n", next) == NULL) {
+                put(ref, ch);
+                r++;
+            } else {
+                put(ref, next);
+                r += 2;
+            }
+            continue;
+        }
+        if (ch == '$' && text[r + 1] == '(') {
+            size_t close = refClosingParen(ref, r + 2);
+            put(ref, VARS_COMMAND_MARKER);
+            for (size_t i = r + 2; i < close; i++) {
+                put(ref, text[i]);
+            }
+            put(ref, VARS_COMMAND_MARKER);
+            r = text[close] != 0 ? close + 1 : close;
+            continue;
+        }
+        const char *name;
+        size_t nameLen;
+        size_t len = ch == '$' ? refReference(text + r + 1, &name, &nameLen) : 0;
+        if (len > 0) {
+            put(ref, VARS_MARKER);
+            for (size_t i = 0; i < nameLen; i++) {
+                put(ref, name[i]);
+            }
+            put(ref, VARS_MARKER);
+            r += len + 1;
+            continue;
+        }
+        if (quote == '"') {
+            if (ch != '"')
+                put(ref, ch);
+            else
+                quote = 0;
+            r++;
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\n' || refIsOperator(ch))
+            break;
+        if (ch == '\'' || ch == '"') {
+            quote = ch;
+            quoted = true;
+        } else {
+            put(ref, ch);
+        }
+        r++;
+    }
+    *pos = r;
+    return ref->outLen > start || quoted;
+}
+
+static bool refTokenize(Reference *ref, const char *text) {
+    ref->text = text;
+    ref->outLen = 0;
+    ref->count = 0;
+    ref->unterminated = false;
+
+    size_t r = 0;
+    while (true) {
+        char ch = text[r];
+        if (ch == 0)
+            break;
+        if (ch == ' ' || ch == '\t' || ch == '\n') {
+            r++;
+        } else if (refIsOperator(ch)) {
+            size_t len = 1;
+            while (refIsOperator(text[r + len]))
+                len++;
+            pushToken(ref, refOperator(text + r, len), 0, false);
+            r += len;
+        } else if (ch == '#') {
+            pushToken(ref, COMMAND_TYPE_COMMENT, 0, false);
+            while (text[r] != 0 && text[r] != '\n')
+                r++;
+        } else if (ch == '(') {
+            size_t close = refClosingParen(ref, r + 1);
+            pushToken(ref, COMMAND_TYPE_SUBSHELL, ref->outLen, true);
+            for (size_t i = r + 1; i < close; i++) {
+                put(ref, text[i]);
+            }
+            put(ref, 0);
+            r = text[close] != 0 ? close + 1 : close;
+        } else {
+            size_t start = ref->outLen;
+            if (refWord(ref, &r)) {
+                put(ref, 0);
+                pushToken(ref, COMMAND_TYPE_REGULAR, start, true);
+            }
+        }
+    }
+    return !ref->unterminated;
+}
+
+static void printEscaped(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s != 0; s++) {
+        unsigned char ch = (unsigned char) *s;
+        if (ch == '\n')
+            fputs("\\n", out);
+        else if (ch == '\t')
+            fputs("\\t", out);
+        else if (ch == '"' || ch == '\\')
+            fprintf(out, "\\%c", ch);
+        else if (ch < 0x20 || ch >= 0x7f)
+            fprintf(out, "\\x%02x", ch);
+        else
+            fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * Tokenizes a copy of the text with both tokenizers and compares the results. Prints both token lists on a mismatch.
+ * The text is null-terminated, *tokenCount is the number of tokens found.
+ */
+static bool checkLine(Reference *ref, const char *text, size_t len, size_t *tokenCount, bool *terminated) {
+    static char *copy = NULL;
+    static size_t copyCapacity = 0;
+    copy = (char *) grow(copy, &copyCapacity, len + 1, sizeof(char));
+    memcpy(copy, text, len + 1);
+
+    const ParserToken *tokens;
+    size_t count;
+    bool parsed = parserTokenizeBuffer(copy, len, &tokens, &count);
+    bool expected = refTokenize(ref, text);
+
+    bool same = parsed == expected && count == ref->count;
+    for (size_t i = 0; same && i < count; i++) {
+        const RefToken *token = &ref->tokens[i];
+        same = tokens[i].type == token->type && (tokens[i].word != NULL) == token->hasText &&
+               (!token->hasText || strcmp(tokens[i].word, ref->out + token->offset) == 0);
+    }
+    *tokenCount = count;
+    *terminated = expected;
+    if (same)
+        return true;
+
+    fprintf(stderr, "Mismatch on ");
+    printEscaped(stderr, text);
+    fprintf(stderr, "\nparser (%s):", parsed ? "complete" : "unterminated");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(stderr, " %u:", tokens[i].type);
+        if (tokens[i].word != NULL)
+            printEscaped(stderr, tokens[i].word);
+    }
+    fprintf(stderr, "\nreference (%s):", expected ? "complete" : "unterminated");
+    for (size_t i = 0; i < ref->count; i++) {
+        fprintf(stderr, " %u:", ref->tokens[i].type);
+        if (ref->tokens[i].hasText)
+            printEscaped(stderr, ref->out + ref->tokens[i].offset);
+    }
+    fprintf(stderr, "\n");
+    return false;
+}
+
+#ifdef PARSER_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static Reference ref = {0};
+    static char *text = NULL;
+    static size_t capacity = 0;
+    // The shell never sees a null byte inside a line
+    size_t len = strnlen((const char *) data, size);
+    text = (char *) grow(text, &capacity, len + 1, sizeof(char));
+    memcpy(text, data, len);
+    text[len] = 0;
+
+    size_t tokenCount;
+    bool terminated;
+    if (!checkLine(&ref, text, len, &tokenCount, &terminated))
+        abort();
+    return 0;
+}
+
+#else
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Buffer;
+
+static void append(Buffer *buf, const char *s, size_t len) {
+    buf->data = (char *) grow(buf->data, &buf->capacity, buf->len + len + 1, sizeof(char));
+    memcpy(buf->data + buf->len, s, len);
+    buf->len += len;
+    buf->data[buf->len] = 0;
+}
+
+static void appendString(Buffer *buf, const char *s) {
+    append(buf, s, strlen(s));
+}
+
+static const char *pick(const char *const *items, size_t count) {
+    return items[rand() % count];
+}
+
+#define PICK(items) pick(items, sizeof(items) / sizeof(items[0]))
+
+static const char *const plainWords[] = {"echo", "ls", "-l", "cat", "a", "file.txt", "x=1", "PATH=/bin", "1", "--",
+                                         "a(b", "b)", "%1", "=", "{}", ":::", "~", "*.c", "a#b", "\x01"};
+static const char *const names[] = {"HOME", "x", "_a1", "PATH", "1x", "a-b", "", "?", "$"};
+static const char *const operators[] = {"|", "||", "&", "&&", ">", ">>", "|&", "&&&", ">|", "<"};
+static const char *const blanks[] = {" ", "  ", "\t", " \t "};
+
+static void generateWord(Buffer *buf, int depth);
+
+/* Text of $( ... ) or ( ... ), balanced unless the line is meant to be cut */
+static void generateList(Buffer *buf, int depth) {
+    int words = 1 + rand() % 4;
+    for (int i = 0; i < words; i++) {
+        if (i > 0)
+            appendString(buf, rand() % 4 == 0 ? PICK(operators) : PICK(blanks));
+        generateWord(buf, depth + 1);
+    }
+    if (rand() % 8 == 0)
+        appendString(buf, "\n");
+}
+
+static void generatePart(Buffer *buf, int depth) {
+    switch (rand() % 14) {
+        case 0:
+            appendString(buf, "'");
+            appendString(buf, PICK(plainWords));
+            appendString(buf, rand() % 2 ? " $x \\ \" " : "");
+            appendString(buf, "'");
+            break;
+        case 1:
+            appendString(buf, "\"");
+            for (int i = rand() % 4; i > 0; i--) {
+                static const char *const inside[] = {"a b", "$x", "${HOME}", "\\\"", "\\\\", "\\$", "\\a", "'",
+                                                     "|&>", "#", "(", ")", "$", "\\\n", "\n"};
+                appendString(buf, PICK(inside));
+            }
+            if (depth < 3 && rand() % 4 == 0) {
+                appendString(buf, "$(");
+                generateList(buf, depth);
+                appendString(buf, ")");
+            }
+            appendString(buf, "\"");
+            break;
+        case 2:
+            appendString(buf, "$");
+            appendString(buf, PICK(names));
+            break;
+        case 3:
+            appendString(buf, "${");
+            appendString(buf, PICK(names));
+            appendString(buf, "}");
+            break;
+        case 4:
+            if (depth < 3) {
+                appendString(buf, "$(");
+                generateList(buf, depth);
+                appendString(buf, ")");
+            }
+            break;
+        case 5: {
+            static const char *const escapes[] = {"\\ ", "\\|", "\\'", "\\\"", "\\\\", "\\$", "\\#", "\\(", "\\\n"};
+            appendString(buf, PICK(escapes));
+            break;
+        }
+        case 6:
+            appendString(buf, "''");
+            break;
+        default:
+            appendString(buf, PICK(plainWords));
+            break;
+    }
+}
+
+static void generateWord(Buffer *buf, int depth) {
+    int parts = 1 + rand() % 3;
+    for (int i = 0; i < parts; i++) {
+        generatePart(buf, depth);
+    }
+}
+
+/* A command line without the trailing newline */
+static void generateLine(Buffer *buf) {
+    int items = 1 + rand() % 8;
+    for (int i = 0; i < items; i++) {
+        if (i > 0)
+            appendString(buf, PICK(blanks));
+        int kind = rand() % 12;
+        if (kind < 7) {
+            generateWord(buf, 0);
+        } else if (kind < 10) {
+            appendString(buf, PICK(operators));
+        } else if (kind == 10) {
+            appendString(buf, "(");
+            generateList(buf, 0);
+            appendString(buf, ")");
+        } else {
+            appendString(buf, "# comment 'x");
+            break;
+        }
+    }
+    // A few lines are cut to exercise unterminated quotes and parentheses
+    if (rand() % 16 == 0 && buf->len > 0)
+        buf->data[--buf->len] = 0;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void printThroughput(const char *name, size_t tokens, size_t bytes, double elapsed) {
+    printf("%s: %zu tokens, %.3f s, %.2f M tokens/s, %.1f MB/s\n", name, tokens, elapsed, tokens / elapsed / 1e6,
+           bytes / elapsed / 1e6);
+}
+
+/* Tokenizes the corpus over and over for about the given time, the parser gets a fresh copy every round */
+static void measure(Reference *ref, const Buffer *corpus, double duration) {
+    char *copy = (char *) malloc(corpus->len + 1);
+    if (copy == NULL) {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t tokens = 0;
+    size_t bytes = 0;
+    double started = now();
+    double elapsed;
+    do {
+        memcpy(copy, corpus->data, corpus->len + 1);
+        const ParserToken *result;
+        size_t count;
+        parserTokenizeBuffer(copy, corpus->len, &result, &count);
+        tokens += count;
+        bytes += corpus->len;
+    } while ((elapsed = now() - started) < duration);
+    printThroughput("parser", tokens, bytes, elapsed);
+
+    tokens = 0;
+    bytes = 0;
+    started = now();
+    do {
+        refTokenize(ref, corpus->data);
+        tokens += ref->count;
+        bytes += corpus->len;
+    } while ((elapsed = now() - started) < duration);
+    printThroughput("reference", tokens, bytes, elapsed);
+    free(copy);
+}
+
+int main(int argc, char **argv) {
+    size_t cases = 100000;
+    unsigned seed = (unsigned) time(NULL);
+    double duration = 1;
+    size_t corpusLines = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:d:l:")) != -1) {
+        switch (opt) {
+            case 'n':
+                cases = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = (unsigned) strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                duration = strtod(optarg, NULL);
+                break;
+            case 'l':
+                corpusLines = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n cases] [-s seed] [-d seconds] [-l corpus lines]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    srand(seed);
+
+    Reference ref = {0};
+    Buffer line = {0};
+    size_t unterminated = 0;
+    size_t tokens = 0;
+    for (size_t i = 0; i < cases; i++) {
+        line.len = 0;
+        generateLine(&line);
+        appendString(&line, "");
+        size_t count;
+        bool terminated;
+        if (!checkLine(&ref, line.data, line.len, &count, &terminated)) {
+            fprintf(stderr, "seed %u, case %zu\n", seed, i);
+            return EXIT_FAILURE;
+        }
+        tokens += count;
+        unterminated += !terminated;
+    }
+    printf("seed %u: %zu cases, %zu tokens, %zu unterminated, no mismatches\n", seed, cases, tokens, unterminated);
+
+    // Only complete lines go to the corpus, the tokenizers stop at the first unterminated one
+    Buffer corpus = {0};
+    for (size_t i = 0; i < corpusLines; i++) {
+        size_t start = corpus.len;
+        generateLine(&corpus);
+        size_t count;
+        bool terminated;
+        checkLine(&ref, corpus.data + start, corpus.len - start, &count, &terminated);
+        if (!terminated) {
+            corpus.len = start;
+            corpus.data[start] = 0;
+            continue;
+        }
+        appendString(&corpus, "\n");
+    }
+    if (corpus.len > 0)
+        measure(&ref, &corpus, duration);
+    return EXIT_SUCCESS;
+}
+
+#endif
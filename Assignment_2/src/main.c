@@ -5,15 +5,36 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parser/parser.h"
+#include "parser/vars.h"
 #include "executor/executor.h"
 
 #define INPUT_SIZE 1024
+// Capacity of pipes between stages of pipelines in bytes, if -p is not given
+#define PIPE_SIZE_ENV "SHELL_PIPE_SIZE"
+// File for the trace of reaped children, if -t is not given
+#define TRACE_LOG_ENV "SHELL_TRACE_LOG"
+// Any value but 0 starts the fork server, like -S
+#define FORK_SERVER_ENV "SHELL_FORK_SERVER"
 
 #ifdef DEBUG
 #define LOG(fmt, ...) printf("[DEBUG] " fmt "\n", ##__VA_ARGS__)
 #endif
 
+static bool setPipeSize(const char *value) {
+    char *end = NULL;
+    long bytes = strtol(value, &end, 10);
+    if (end == value || *end != 0 || bytes < 0 || bytes > INT32_MAX) {
+        printf("Bad pipe size: %s\n", value);
+        return false;
+    }
+    executorSetPipeSize((int) bytes);
+    return true;
+}
+
 static bool checkClosedParenthesis(char *const input, size_t len) {
     bool opened = false;
     for (size_t i = 0; i < len; i++) {
@@ -24,11 +45,113 @@ static bool checkClosedParenthesis(char *const input, size_t len) {
     return !opened;
 }
 
+/*
+ * Maps the script privately: pages are copied only where the tokenizer writes unquoted words back.
+ * Text must be null-terminated, which the zero tail of the last page gives for free unless the size is a multiple
+ * of the page size; such script is read into memory.
+ */
+static char *loadScript(const char *name, size_t *len, bool *mapped) {
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("%s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        printf("%s: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    *len = st.st_size;
+
+    char *text = NULL;
+    *mapped = *len > 0 && *len % sysconf(_SC_PAGESIZE) != 0;
+    if (*mapped) {
+        text = (char *) mmap(NULL, *len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            text = NULL;
+        }
+    } else {
+        text = (char *) calloc(*len + 1, sizeof(char));
+        if (text != NULL && read(fd, text, *len) != (ssize_t) *len) {
+            free(text);
+            text = NULL;
+        }
+    }
+    if (text == NULL) {
+        printf("%s: failed to load: %s\n", name, strerror(errno));
+    }
+    close(fd);
+    return text;
+}
+
 int main(int argc, char **argv)
 {
+    const char *scriptName = NULL;
+    char *commandString = NULL;
+    const char *pipeSize = getenv(PIPE_SIZE_ENV);
+    const char *traceLog = getenv(TRACE_LOG_ENV);
+    const char *forkServer = getenv(FORK_SERVER_ENV);
+    bool useForkServer = forkServer != NULL && strcmp(forkServer, "0") != 0;
+    varsSetShellPid(getpid());
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:p:t:S")) != -1) {
+        switch (opt) {
+            case 'f':
+                scriptName = optarg;
+                break;
+            case 'c':
+                commandString = optarg;
+                break;
+            case 'p':
+                pipeSize = optarg;
+                break;
+            case 't':
+                traceLog = optarg;
+                break;
+            case 'S':
+                useForkServer = true;
+                break;
+            default:
+                printf("Usage: %s [-p pipe_size] [-t trace_log] [-S] [-f script | -c string]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    // Before anything is allocated for the scripts and commands, so the helper stays small
+    if (useForkServer) {
+        executorStartForkServer();
+    }
+    if (pipeSize != NULL && !setPipeSize(pipeSize)) {
+        return EXIT_FAILURE;
+    }
+    if (traceLog != NULL && !executorSetTraceLog(traceLog)) {
+        return EXIT_FAILURE;
+    }
+    if (commandString != NULL) {
+        return executorRunScript(commandString, strlen(commandString));
+    }
+    if (scriptName != NULL) {
+        size_t len = 0;
+        bool mapped = false;
+        char *text = loadScript(scriptName, &len, &mapped);
+        if (text == NULL) {
+            return EXIT_FAILURE;
+        }
+        int ret = executorRunScript(text, len);
+        if (mapped) {
+            munmap(text, len + 1);
+        } else {
+            free(text);
+        }
+        return ret;
+    }
+
     while (true) {
         char *input = NULL;
-        CommandArray parsed = parser(&input); // -1 required to exclude newline
+        CommandList parsed = parser(&input); // -1 required to exclude newline
+        if (parserEof()) {
+            break;
+        }
 //        for (size_t i = 0; i < parsed.size; i++) {
 //            printf("[%lu] %s\n", i, parsed.tokens[i].name);
 //            for (size_t k = 0; k < parsed.tokens[i].argc; k++) {
@@ -39,8 +162,17 @@ int main(int argc, char **argv)
 //        LOG("Parsed %u comamnds", parsed.tokenCount);
 
         execute(parsed);
+#ifdef DEBUG
+        const int *statuses;
+        size_t stages = executorPipeStatus(&statuses);
+        for (size_t i = 0; i < stages; i++) {
+            LOG("PIPESTATUS[%lu] = %d", i, statuses[i]);
+        }
+#endif
 
 //        free(input);
-//        parser_free(&parsed);
+        parser_free(&parsed);
     }
+    fflush(stdout);
+    return executorLastStatus();
 }
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "input.h"
+#include "smallvector.h"
+
+// Power of two, so positions wrap with a mask
+#define RING_CAPACITY (64 * 1024)
+#define INITIAL_BUFFER_SIZE 128
+#define INLINE_HISTORY_ENTRIES 1
+
+typedef struct {
+    char data[RING_CAPACITY];
+    // Position of the first unread byte and the number of them
+    size_t head;
+    size_t size;
+    bool eof;
+} InputRing;
+
+typedef struct {
+    // Entries one after another, each of them null-terminated
+    char *text;
+    size_t len;
+    size_t capacity;
+    // Start of the entry being read
+    size_t pending;
+    SMALL_VECTOR(size_t, INLINE_HISTORY_ENTRIES) entries;
+    // -1 until stdin has been checked
+    int enabled;
+} History;
+
+static InputRing ring = {0};
+static History history = {.enabled = -1};
+
+static bool grow(char **buf, size_t *capacity, size_t required) {
+    if (required <= *capacity)
+        return true;
+    size_t newCapacity = *capacity == 0 ? INITIAL_BUFFER_SIZE : *capacity;
+    while (newCapacity < required)
+        newCapacity *= 2;
+    char *newBuf = (char *) realloc(*buf, newCapacity);
+    if (newBuf == NULL) {
+        printf("Failed to allocate input buffer\n");
+        return false;
+    }
+    *buf = newBuf;
+    *capacity = newCapacity;
+    return true;
+}
+
+/* Reads into the free space after the unread bytes, as much as fits without wrapping. */
+static void fill() {
+    size_t tail = (ring.head + ring.size) & (RING_CAPACITY - 1);
+    size_t space = RING_CAPACITY - ring.size;
+    if (space > RING_CAPACITY - tail)
+        space = RING_CAPACITY - tail;
+    ssize_t got;
+    do {
+        got = read(STDIN_FILENO, ring.data + tail, space);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+        ring.eof = true;
+        return;
+    }
+    ring.size += got;
+}
+
+static void historyAppend(const char *text, size_t len) {
+    if (history.enabled < 0)
+        history.enabled = isatty(STDIN_FILENO);
+    if (!history.enabled || !grow(&history.text, &history.capacity, history.len + len + 1))
+        return;
+    memcpy(history.text + history.len, text, len);
+    history.len += len;
+}
+
+size_t inputReadLine(char **buf, size_t *len, size_t *capacity) {
+    size_t start = *len;
+    bool lineEnded = false;
+    while (!lineEnded) {
+        if (ring.size == 0) {
+            if (ring.eof)
+                break;
+            fill();
+            continue;
+        }
+        // Unread bytes up to the end of the ring, the rest of them wrapped to its start
+        size_t available = RING_CAPACITY - ring.head;
+        if (available > ring.size)
+            available = ring.size;
+        const char *from = ring.data + ring.head;
+        const char *newline = (const char *) memchr(from, '\n', available);
+        size_t n = newline != NULL ? (size_t) (newline - from) + 1 : available;
+        lineEnded = newline != NULL;
+
+        if (!grow(buf, capacity, *len + n + 1))
+            exit(EXIT_FAILURE);
+        memcpy(*buf + *len, from, n);
+        *len += n;
+        ring.head = (ring.head + n) & (RING_CAPACITY - 1);
+        ring.size -= n;
+    }
+    if (*buf != NULL)
+        (*buf)[*len] = 0;
+    historyAppend(*buf + start, *len - start);
+    return *len - start;
+}
+
+void historyCommit() {
+    if (history.enabled <= 0)
+        return;
+    size_t end = history.len;
+    while (end > history.pending && (history.text[end - 1] == '\n' || history.text[end - 1] == ' '))
+        end--;
+    if (end == history.pending) {
+        history.len = history.pending;
+        return;
+    }
+    size_t *entry = smallVectorPush(&history.entries);
+    if (entry == NULL) {
+        history.len = history.pending;
+        return;
+    }
+    *entry = history.pending;
+    history.text[end] = 0;
+    history.len = end + 1;
+    history.pending = history.len;
+}
+
+size_t historySize() {
+    return history.entries.size;
+}
+
+const char *historyEntry(size_t i) {
+    return history.text + history.entries.data[i];
+}
+
+void historyPrint(FILE *out) {
+    for (size_t i = 0; i < history.entries.size; i++) {
+        fprintf(out, "%5zu  %s\n", i + 1, historyEntry(i));
+    }
+}
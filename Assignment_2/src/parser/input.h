@@ -0,0 +1,28 @@
+#pragma once
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Input layer of the shell: stdin is read in large chunks into a ring buffer and lines are cut from it straight
+ * into the line buffer of the parser, every byte is looked at once. When stdin is a terminal, logical lines are
+ * also kept in the history, one append-only arena for all of them.
+ */
+
+// Appends the next line of stdin, with its newline if it has one, at *len of the buffer, which grows as needed and
+// stays null-terminated. Returns the length of the line, 0 at end of input.
+size_t inputReadLine(char **buf, size_t *len, size_t *capacity);
+
+// Finishes the history entry of the lines read since the previous call, blank ones are dropped
+void historyCommit();
+size_t historySize();
+// Entries are numbered from 0, the pointer is valid until the next line is read
+const char *historyEntry(size_t i);
+void historyPrint(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
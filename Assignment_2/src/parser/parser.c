@@ -6,81 +6,110 @@
 #include <string.h>
 #include <stdlib.h>
 #include "parser.h"
+#include "smallvector.h"
+#include "vars.h"
+#include "input.h"
 
 #define INITIAL_SEQUENCE_SIZE 8
-#define EXTENSION_SIZE 2
+// Command lines up to that number of tokens don't allocate the token list
+#define INLINE_TOKENS 64
+// Word before a pipeline which prints how long it has run
+#define TIME_PREFIX "time"
 
-static CommandArray initArray();
-static uint32_t extendCommandArray(CommandArray *array);
-static Command *allocateCommand(CommandArray *array);
-
-static CommandArray initArray() {
-    size_t commandsSize = INITIAL_SEQUENCE_SIZE;
-    Command *commands = (Command *) calloc(commandsSize, sizeof(Command));
-
-    CommandArray ret = {
-            .tokens = commands,
-            .size = 0,
-            .capacity = INITIAL_SEQUENCE_SIZE
-    };
-    return ret;
-}
-
-static uint32_t extendCommandArray(CommandArray *array) {
-    size_t newCapacity = array->capacity + EXTENSION_SIZE;
-    Command *newArray = (Command *) calloc(newCapacity, sizeof(Command));
-    if (newArray == NULL) {
-        printf("Failed to allocate extended command array\n");
-        return EXIT_FAILURE;
+/*
+ * Tokens are parsed in place: quotes and escapes are removed by moving the characters of a word to the left
+ * inside the line buffer, and words are terminated there, so argv entries point into the buffer.
+ * The buffer, the token list and the commands are kept in an arena reused by every command line,
+ * so a line costs no allocations once the arena has grown to fit it.
+ * A word referring to variables or commands may grow, it is written to a separate buffer of the arena with the
+ * references marked, and they are replaced by values and output when the command runs. Text of ( ... ) is copied
+ * there too and is parsed by the shell which runs it.
+ */
+
+typedef struct {
+    uint32_t type;
+    // Offset of a word in the line buffer, the buffer may be moved while continuation lines are read
+    size_t offset;
+    // The word refers to variables and is kept in the words buffer
+    bool expand;
+} Token;
+
+typedef struct {
+    // Logical line: the input line and its continuation lines, which are read right after it
+    char *text;
+    size_t textLen;
+    size_t textCapacity;
+
+    // Words with variable references
+    char *words;
+    size_t wordsLen;
+    size_t wordsCapacity;
+
+    SMALL_VECTOR(Token, INLINE_TOKENS) tokens;
+
+    // Nodes of the AST and argv arrays
+    void *block;
+    size_t blockSize;
+
+    // Continuation lines are read from stdin, a script has them all in text already
+    bool readsStdin;
+    // The text has ended inside quotes or parentheses
+    bool unterminated;
+} ParserArena;
+
+static ParserArena arena = {.readsStdin = true};
+static bool eofReached = false;
+
+static bool reserve(void **ptr, size_t *capacity, size_t required, size_t elementSize) {
+    if (required <= *capacity)
+        return true;
+    size_t newCapacity = *capacity == 0 ? INITIAL_SEQUENCE_SIZE : *capacity;
+    while (newCapacity < required)
+        newCapacity *= 2;
+    void *newPtr = realloc(*ptr, newCapacity * elementSize);
+    if (newPtr == NULL) {
+        printf("Failed to allocate parser arena\n");
+        return false;
     }
-    memcpy(newArray, array->tokens, array->size * sizeof(Command));
-    free(array->tokens);
-    array->tokens = newArray;
-    return EXIT_SUCCESS;
+    *ptr = newPtr;
+    *capacity = newCapacity;
+    return true;
 }
 
-static Command *allocateCommand(CommandArray *array) {
-    if (array->size == array->capacity) {
-        extendCommandArray(array);
+static bool readFirstLine(ParserArena *a) {
+    a->textLen = 0;
+    if (inputReadLine(&a->text, &a->textLen, &a->textCapacity) == 0) {
+        eofReached = true;
+        return false;
     }
-    Command *ret = &array->tokens[array->size];
-    ret->argv = (char **) calloc(INITIAL_SEQUENCE_SIZE, sizeof(char *));
-    ret->argc = 0;
-    ret->argCapacity = INITIAL_SEQUENCE_SIZE;
-
-    array->size++;
-    return ret;
+    return true;
 }
 
-static uint32_t extendArgv(Command *cmd) {
-    size_t newCap = cmd->argCapacity;
-    char **newArgv = (char **) malloc(newCap * sizeof(char *) + 1); // argv must be null-terminated array
-    memset(newArgv, 0, newCap * sizeof(char *) + 1);
-    if (newArgv == NULL) {
-        return EXIT_FAILURE;
+/* A script has all of its lines in text already: the line can't go on, which is reported after tokenizing. */
+static bool readContinuationLine(ParserArena *a) {
+    if (!a->readsStdin) {
+        a->unterminated = true;
+        return false;
     }
-    memcpy(newArgv, cmd->argv, sizeof(char *) * cmd->argc);
-    free(cmd->argv);
-    cmd->argCapacity = newCap;
-    return EXIT_SUCCESS;
-}
-
-static void addArg(Command *cmd, const char *const arg, size_t len) {
-    if (cmd->argc == cmd->argCapacity) {
-        extendArgv(cmd);
+    // Tokenizing goes on from where it stopped, the part of the line before is not scanned again
+    if (inputReadLine(&a->text, &a->textLen, &a->textCapacity) == 0) {
+        exit(EXIT_FAILURE);
     }
+    return true;
+}
 
-    size_t i = cmd->argc;
-    cmd->argc++;
-    cmd->argv[i] = (char *) calloc(len + 1, sizeof(char));
-    memcpy(cmd->argv[i], arg, len);
-    cmd->argv[i][len] = 0;
-    if (i == 0) {
-        cmd->name = cmd->argv[i];
+static void addToken(ParserArena *a, uint32_t type, size_t offset, bool expand) {
+    Token *token = smallVectorPush(&a->tokens);
+    if (token == NULL) {
+        printf("Failed to allocate parser arena\n");
+        exit(EXIT_FAILURE);
     }
+    token->type = type;
+    token->offset = offset;
+    token->expand = expand;
 }
 
-bool isSpecialChar(char ch) {
+static bool isSpecialChar(char ch) {
     switch (ch) {
         case '|':
         case '&':
@@ -91,200 +120,582 @@ bool isSpecialChar(char ch) {
     }
 }
 
-bool isSpecialToken(char *t) {
-    return isSpecialChar(t[0]);
+static bool isBlank(char ch) {
+    return ch == ' ' || ch == '\t';
 }
 
-CommandArray parser(char **input) {
-    CommandArray ca = initArray();
+static uint32_t operatorType(char first, size_t len, char second) {
+    if (len == 1) {
+        switch (first) {
+            case '|':
+                return COMMAND_TYPE_OPERATOR_PIPE;
+            case '>':
+                return COMMAND_TYPE_OPERATOR_WRITE;
+            case '&':
+                return COMMAND_TYPE_BACKGROUND;
+        }
+    }
+    if (len == 2 && first == second) {
+        switch (first) {
+            case '|':
+                return COMMAND_TYPE_OPERATOR_OR;
+            case '>':
+                return COMMAND_TYPE_OPERATOR_APPEND;
+            case '&':
+                return COMMAND_TYPE_OPERATOR_AND;
+        }
+    }
+    return COMMAND_TYPE_UNKNOWN;
+}
 
-    char **argList = (char **) calloc(INITIAL_SEQUENCE_SIZE, sizeof(char *));
-    size_t argCount = 0;
-    size_t argCap = INITIAL_SEQUENCE_SIZE;
+/* Characters escaped by a backslash inside double quotes */
+static bool isEscapedInDoubleQuotes(char ch) {
+    return ch == '"' || ch == '\\' || ch == '$' || ch == '`' || ch == '\n';
+}
 
-    size_t last_mirrored_slash = -1;
-    do {
-        char *buf = NULL;
-        size_t bufLen = 0;
-        long ret = getline(&buf, &bufLen, stdin);
-        if (ret == -1) {
-            exit(EXIT_FAILURE);
+static bool isNameChar(char ch) {
+    return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9');
+}
+
+/* Output of a word: in place while it has no variable references, then in the words buffer */
+typedef struct {
+    size_t w;
+    bool spilled;
+    size_t wordStart;
+} WordOutput;
+
+static void emit(ParserArena *a, WordOutput *out, char ch) {
+    if (!out->spilled) {
+        a->text[out->w++] = ch;
+        return;
+    }
+    if (!reserve((void **) &a->words, &a->wordsCapacity, a->wordsLen + 1, sizeof(char))) {
+        exit(EXIT_FAILURE);
+    }
+    a->words[a->wordsLen++] = ch;
+}
+
+/* Moves the part of the word written in place to the words buffer */
+static void spill(ParserArena *a, WordOutput *out, size_t start) {
+    out->spilled = true;
+    out->wordStart = a->wordsLen;
+    for (size_t i = start; i < out->w; i++) {
+        emit(a, out, a->text[i]);
+    }
+    out->w = start;
+}
+
+/*
+ * Parses a variable reference after '$': NAME, {NAME}, ? or $. Returns the number of characters after '$'
+ * taken by the reference, 0 if the '$' is an ordinary character.
+ */
+static size_t parseReference(const char *text, size_t *nameStart, size_t *nameLen) {
+    if (text[0] == '?' || text[0] == '$') {
+        *nameStart = 0;
+        *nameLen = 1;
+        return 1;
+    }
+    if (text[0] == '{') {
+        const char *end = strchr(text, '}');
+        if (end == NULL || !varsIsName(text + 1, end - text - 1))
+            return 0;
+        *nameStart = 1;
+        *nameLen = end - text - 1;
+        return *nameLen + 2;
+    }
+    if (!varsIsName(text, 1))
+        return 0;
+    size_t len = 1;
+    while (isNameChar(text[len]))
+        len++;
+    *nameStart = 0;
+    *nameLen = len;
+    return len;
+}
+
+/*
+ * Finds the parenthesis closing the one before pos, skipping quoted text and nested parentheses.
+ * Reads continuation lines until it is found. Returns the end of the text if there are no more lines.
+ */
+static size_t findClosingParen(ParserArena *a, size_t pos) {
+    size_t depth = 1;
+    char quote = 0;
+    while (true) {
+        char ch = a->text[pos];
+        if (ch == 0) {
+            if (!readContinuationLine(a))
+                return pos;
+            continue;
         }
-        size_t len = ret;
-
-        size_t startPos = 0;
-        while (startPos < len) {
-            bool singleParOpened = false;
-            bool doubleParOpened = false;
-            while (startPos < len && (
-                    buf[startPos] == ' ' ||
-                    buf[startPos] == '\n' && startPos == 0
-                )) {
-                startPos++;
-            }
+        if (quote == '\'') {
+            if (ch == '\'')
+                quote = 0;
+        } else if (ch == '\\') {
+            if (a->text[pos + 1] != 0)
+                pos++;
+        } else if (quote == '"') {
+            if (ch == '"')
+                quote = 0;
+        } else if (ch == '\'' || ch == '"') {
+            quote = ch;
+        } else if (ch == '(') {
+            depth++;
+        } else if (ch == ')' && --depth == 0) {
+            return pos;
+        }
+        pos++;
+    }
+}
 
-            if (startPos >= len || buf[startPos] == '\n')
+/* Copies text of [from, to) between the markers, or with the terminating null if marker is 0. */
+static void emitRaw(ParserArena *a, WordOutput *out, size_t from, size_t to, char marker) {
+    if (marker != 0)
+        emit(a, out, marker);
+    for (size_t i = from; i < to; i++) {
+        emit(a, out, a->text[i]);
+    }
+    emit(a, out, marker);
+}
+
+/*
+ * Parses a word starting at *readPos and writes it unquoted at *writePos, which never passes *readPos.
+ * A word with variable references is written to the words buffer instead, *wordStart is set to its offset there.
+ * Reads continuation lines if the word has an unclosed quote or ends with a backslash before newline.
+ * Returns false if the word is empty and was not quoted.
+ */
+static bool parseWord(ParserArena *a, size_t *readPos, size_t *writePos, bool *spilled, size_t *wordStart) {
+    size_t r = *readPos;
+    WordOutput out = {.w = *writePos};
+    bool singleQuoted = false;
+    bool doubleQuoted = false;
+    bool hadQuotes = false;
+
+    while (true) {
+        char ch = a->text[r];
+        if (ch == 0) {
+            if ((!singleQuoted && !doubleQuoted) || !readContinuationLine(a))
                 break;
+            continue;
+        }
+        if (singleQuoted) {
+            if (ch == '\'')
+                singleQuoted = false;
+            else
+                emit(a, &out, ch);
+            r++;
+            continue;
+        }
+        if (ch == '\\') {
+            char next = a->text[r + 1];
+            if (next == '\n') {
+                // Line continuation, the word goes on at the next line
+                r += 2;
+                if (a->text[r] == 0)
+                    readContinuationLine(a);
+                continue;
+            }
+            if (next == 0) {
+                r++;
+                continue;
+            }
+            if (doubleQuoted && !isEscapedInDoubleQuotes(next)) {
+                emit(a, &out, ch);
+                r++;
+                continue;
+            }
+            emit(a, &out, next);
+            r += 2;
+            continue;
+        }
+        if (ch == '$' && a->text[r + 1] == '(') {
+            size_t close = findClosingParen(a, r + 2);
+            if (!out.spilled)
+                spill(a, &out, *writePos);
+            emitRaw(a, &out, r + 2, close, VARS_COMMAND_MARKER);
+            r = a->text[close] != 0 ? close + 1 : close;
+            continue;
+        }
+        if (ch == '$') {
+            size_t nameStart, nameLen;
+            size_t len = parseReference(a->text + r + 1, &nameStart, &nameLen);
+            if (len > 0) {
+                if (!out.spilled)
+                    spill(a, &out, *writePos);
+                emit(a, &out, VARS_MARKER);
+                for (size_t i = 0; i < nameLen; i++) {
+                    emit(a, &out, a->text[r + 1 + nameStart + i]);
+                }
+                emit(a, &out, VARS_MARKER);
+                r += len + 1;
+                continue;
+            }
+        }
+        if (doubleQuoted) {
+            if (ch == '"')
+                doubleQuoted = false;
+            else
+                emit(a, &out, ch);
+            r++;
+            continue;
+        }
+        if (isBlank(ch) || ch == '\n' || isSpecialChar(ch))
+            break;
+        if (ch == '\'' || ch == '"') {
+            singleQuoted = ch == '\'';
+            doubleQuoted = ch == '"';
+            hadQuotes = true;
+            r++;
+            continue;
+        }
+        emit(a, &out, ch);
+        r++;
+    }
 
-            size_t endPos = startPos;
+    bool nonEmpty = out.w > *writePos || hadQuotes || out.spilled;
+    *readPos = r;
+    *writePos = out.w;
+    *spilled = out.spilled;
+    *wordStart = out.wordStart;
+    return nonEmpty;
+}
 
-            if (isSpecialChar(buf[endPos])) {
-                while (isSpecialChar(buf[endPos]))
-                    endPos++;
-                goto ADD_TO_ARG_LIST;
-            }
+static size_t tokenize(ParserArena *a, size_t pos) {
+    size_t r = pos;
+    size_t w = pos;
+    while (true) {
+        while (isBlank(a->text[r]))
+            r++;
+        char ch = a->text[r];
+        if (ch == 0)
+            return r;
+        if (ch == '\n')
+            return r + 1;
+
+        if (isSpecialChar(ch)) {
+            size_t len = 1;
+            while (isSpecialChar(a->text[r + len]))
+                len++;
+            addToken(a, operatorType(ch, len, a->text[r + 1]), 0, false);
+            r += len;
+            continue;
+        }
 
-            bool trimParen = false;
-            while (endPos < len - 1) {
-                if (buf[endPos] == '\\') {
-                    if (buf[endPos + 1] == '\n') {
-                        buf[endPos] = 0;
-                        char *nextLine = NULL;
-                        size_t newBufSize = 0;
-                        long ret  = getline(&nextLine, &newBufSize, stdin);
-                        if (ret == -1) {
-                            exit(EXIT_FAILURE);
-                        }
-                        size_t newLen = ret;
-
-                        char *newBuf = (char *) calloc(len + newLen + 1, sizeof(char));
-                        strcat(newBuf, buf);
-                        strcat(newBuf, nextLine);
-                        free(nextLine);
-                        free(buf);
-
-                        buf = newBuf;
-                        len += newLen - 1; // -2 for removed mirrored newline
-                        endPos = startPos;
-                        continue;
-                    }
-
-                    last_mirrored_slash = endPos + 1;
-                    endPos += 2;
-                    continue;
-                }
+        if (ch == '(') {
+            size_t close = findClosingParen(a, r + 1);
+            WordOutput out = {.spilled = true};
+            size_t start = a->wordsLen;
+            emitRaw(a, &out, r + 1, close, 0);
+            addToken(a, COMMAND_TYPE_SUBSHELL, start, true);
+            r = a->text[close] != 0 ? close + 1 : close;
+            continue;
+        }
 
-//                if (buf[endPos] == ' ' && endPos > 1 && buf[endPos - 1] == '\\') {
-//                    memmove(&buf[endPos - 1], &buf[endPos], len - endPos);
-//                    len--;
-//                }
+        if (ch == '#') {
+            addToken(a, COMMAND_TYPE_COMMENT, 0, false);
+            while (a->text[r] != 0 && a->text[r] != '\n')
+                r++;
+            continue;
+        }
 
-                if ((buf[endPos] == ' ' || buf[endPos] == '\n' || isSpecialChar(buf[endPos]))
-                    && !singleParOpened && !doubleParOpened) {
-                    break;
-                }
+        size_t start = w;
+        bool spilled;
+        size_t wordStart;
+        if (!parseWord(a, &r, &w, &spilled, &wordStart))
+            continue;
+        // Terminating the word may overwrite the separator after it, so it is handled right here
+        char separator = a->text[r];
+        if (spilled) {
+            WordOutput out = {.spilled = true};
+            emit(a, &out, 0);
+            addToken(a, COMMAND_TYPE_REGULAR, wordStart, true);
+        } else {
+            a->text[w++] = 0;
+            addToken(a, COMMAND_TYPE_REGULAR, start, false);
+        }
+        if (separator == 0)
+            return r;
+        if (separator == '\n')
+            return r + 1;
+        if (w > r && isBlank(separator)) {
+            r++;
+        } else if (w > r) {
+            size_t len = 1;
+            while (isSpecialChar(a->text[r + len]))
+                len++;
+            addToken(a, operatorType(separator, len, a->text[r + 1]), 0, false);
+            r += len;
+        }
+    }
+}
 
-                if (buf[endPos] == '"') {
-                    if (singleParOpened || endPos - 1 >= 0 && buf[endPos - 1] == '\\' && last_mirrored_slash != endPos - 1) {
-                    } else {
-                        doubleParOpened = !doubleParOpened;
-                        trimParen = true;
-                        if (!doubleParOpened)
-                            break;
-                    }
-                }
+typedef struct {
+    AndOrList *lists;
+    Pipeline *pipelines;
+    Command *commands;
+    Redirection *redirections;
+    char **argv;
+} NodeCursor;
+
+/* Reserves the block for nodes of tokenCount tokens: no token starts more than one node of every kind. */
+static NodeCursor reserveNodes(ParserArena *a, size_t tokenCount) {
+    size_t nodeSize = sizeof(AndOrList) + sizeof(Pipeline) + sizeof(Command) + sizeof(Redirection);
+    // Every word takes an argv slot and every command one more for the terminating NULL
+    size_t required = tokenCount * (nodeSize + 2 * sizeof(char *));
+    if (!reserve(&a->block, &a->blockSize, required, 1)) {
+        exit(EXIT_FAILURE);
+    }
+    memset(a->block, 0, required);
+
+    NodeCursor c;
+    c.lists = (AndOrList *) a->block;
+    c.pipelines = (Pipeline *) (c.lists + tokenCount);
+    c.commands = (Command *) (c.pipelines + tokenCount);
+    c.redirections = (Redirection *) (c.commands + tokenCount);
+    c.argv = (char **) (c.redirections + tokenCount);
+    return c;
+}
 
-                if (buf[endPos] == '\'') {
-                    if (doubleParOpened || endPos - 1 >= 0 && buf[endPos - 1] == '\\' && last_mirrored_slash != endPos - 1) {
-                    } else {
-                        singleParOpened = !singleParOpened;
-                        trimParen = true;
-                        if (!singleParOpened)
-                            break;
-                    }
-                }
-                endPos++;
-            }
+static const char *tokenName(uint32_t type) {
+    switch (type) {
+        case COMMAND_TYPE_OPERATOR_AND:
+            return "&&";
+        case COMMAND_TYPE_OPERATOR_OR:
+            return "||";
+        case COMMAND_TYPE_OPERATOR_PIPE:
+            return "|";
+        case COMMAND_TYPE_OPERATOR_APPEND:
+            return ">>";
+        case COMMAND_TYPE_OPERATOR_WRITE:
+            return ">";
+        case COMMAND_TYPE_BACKGROUND:
+            return "&";
+        case COMMAND_TYPE_COMMENT:
+            return "newline";
+        case COMMAND_TYPE_SUBSHELL:
+            return "(";
+        default:
+            return "operator";
+    }
+}
 
-            if (doubleParOpened || singleParOpened) {
-                char *nextLine = NULL;
-                size_t newBufSize = 0;
-                long ret = getline(&nextLine, &newBufSize, stdin);
-                if (ret == -1) {
-                    exit(EXIT_FAILURE);
-                }
-                size_t newLen = ret;
+static char *wordOf(ParserArena *a, const Token *token) {
+    return (token->expand ? a->words : a->text) + token->offset;
+}
 
-                char *newBuf = (char *) calloc(len + newLen + 1, sizeof(char));
-                strcat(newBuf, buf);
-                strcat(newBuf, nextLine);
-                free(nextLine);
-                free(buf);
+static void finishCommand(Command *cmd, NodeCursor *c) {
+    if (cmd == NULL)
+        return;
+    // Slot of the terminating NULL, the block is zeroed
+    c->argv++;
+    cmd->name = cmd->argv[0];
+}
 
-                buf = newBuf;
-                len += newLen;
-                continue;
+/*
+ * Builds the AST of tokens [from, to) of one command line:
+ * list of and-or lists separated by &, and-or list of pipelines joined by && and ||, pipeline of commands joined
+ * by |, command of words and redirections. Returns an empty list after printing a syntax error.
+ */
+static CommandList buildList(ParserArena *a, size_t from, size_t to, NodeCursor *c) {
+    CommandList list = {
+            .lists = c->lists,
+            .size = 0
+    };
+    AndOrList *andOr = NULL;
+    Pipeline *pipeline = NULL;
+    Command *cmd = NULL;
+    // Operator which still waits for the command after it
+    uint32_t pending = COMMAND_TYPE_OPERATOR_AND;
+    bool operatorPending = false;
+
+    for (size_t i = from; i < to; i++) {
+        uint32_t type = a->tokens.data[i].type;
+        if (type == COMMAND_TYPE_REGULAR || type == COMMAND_TYPE_SUBSHELL || type == COMMAND_TYPE_OPERATOR_WRITE ||
+            type == COMMAND_TYPE_OPERATOR_APPEND) {
+            if (cmd == NULL) {
+                if (andOr == NULL) {
+                    andOr = c->lists++;
+                    andOr->pipelines = c->pipelines;
+                    list.size++;
+                }
+                if (pipeline == NULL) {
+                    pipeline = c->pipelines++;
+                    pipeline->commands = c->commands;
+                    pipeline->connector = pending;
+                    andOr->size++;
+                }
+                cmd = c->commands++;
+                cmd->argv = c->argv;
+                cmd->redirections = c->redirections;
+                pipeline->size++;
+                operatorPending = false;
             }
 
-            ADD_TO_ARG_LIST:
-            if (argCount == argCap) {
-                argCap += EXTENSION_SIZE;
-                argList = realloc(argList, argCap * sizeof(char *));
+            // A subshell is the whole command, only redirections may follow it and the time prefix precede it
+            bool timed = cmd->argc == 1 && strcmp(cmd->argv[0], TIME_PREFIX) == 0;
+            bool misplaced = type == COMMAND_TYPE_SUBSHELL
+                             ? (cmd->argc > 0 && !timed) || cmd->subshell != NULL
+                             : type == COMMAND_TYPE_REGULAR && cmd->subshell != NULL;
+            if (misplaced) {
+                printf("Syntax error near unexpected token `%s'\n",
+                       type == COMMAND_TYPE_SUBSHELL ? "(" : wordOf(a, &a->tokens.data[i]));
+                list.size = 0;
+                return list;
             }
-            size_t argLen = !trimParen ? endPos - startPos : endPos - startPos - 1;
-            argList[argCount] = (char *) calloc(argLen, sizeof(char));
-
-//            memcpy(argList[argCount], , argLen);
-            for (size_t i = 0, destI = 0; i < argLen; i++, destI++) {
-                size_t idx = i + (trimParen ? startPos + 1 : startPos);
-                char out = buf[idx];
-                if (out == '\\') {
-                    i++;
-                    out = buf[idx + 1];
-                }
-                argList[argCount][destI] = out;
+            if (type == COMMAND_TYPE_SUBSHELL) {
+                cmd->subshell = wordOf(a, &a->tokens.data[i]);
+                continue;
             }
-//            printf("[%lu] %s\n", argCount, argList[argCount]);
-            argCount++;
-            startPos = trimParen ? endPos + 1 : endPos;
-            trimParen = false;
-        }
-        free(buf);
-        break;
-    } while (0);
-
-    for (size_t i = 0; i < argCount; i++) {
-        if (isSpecialToken(argList[i])) {
-            CommandType type = COMMAND_TYPE_UNKNOWN;
-            if (argList[i][0] == '&' && argList[i][1] == '&') {
-                type = COMMAND_TYPE_OPERATOR_AND;
-            } else if (argList[i][0] == '|' && argList[i][1] != '|') {
-                type = COMMAND_TYPE_OPERATOR_PIPE;
-            } else if (argList[i][0] == '|' && argList[i][1] == '|') {
-                type = COMMAND_TYPE_OPERATOR_OR;
-            } else if (argList[i][0] == '>' && argList[i][1] != '>') {
-                type = COMMAND_TYPE_OPERATOR_WRITE;
-            } else if (argList[i][0] == '>' && argList[i][1] == '>') {
-                type = COMMAND_TYPE_OPERATOR_APPEND;
+            if (type == COMMAND_TYPE_REGULAR) {
+                cmd->argv[cmd->argc++] = wordOf(a, &a->tokens.data[i]);
+                cmd->expand = cmd->expand || a->tokens.data[i].expand;
+                c->argv++;
+                continue;
             }
-            Command *cmd = allocateCommand(&ca);
-            cmd->type = type;
-        } else {
-            Command *cmd = allocateCommand(&ca);
-            for (; i < argCount; i++) {
-                if (isSpecialToken(argList[i]) ) {
-                    i--;
-                    break;
-                }
-                if (strlen(argList[i]) == 0) {
-                    continue;
-                }
-                addArg(cmd, argList[i], strlen(argList[i]));
+            if (i + 1 >= to || a->tokens.data[i + 1].type != COMMAND_TYPE_REGULAR) {
+                printf("Syntax error near unexpected token `%s'\n",
+                       i + 1 < to ? tokenName(a->tokens.data[i + 1].type) : "newline");
+                list.size = 0;
+                return list;
             }
-            if (cmd->argv[0][0] == '#')
-                cmd->type = COMMAND_TYPE_COMMENT;
+            Redirection *redirection = c->redirections++;
+            redirection->type = type;
+            redirection->target = wordOf(a, &a->tokens.data[++i]);
+            cmd->expand = cmd->expand || a->tokens.data[i].expand;
+            cmd->redirectionCount++;
+            continue;
+        }
+
+        finishCommand(cmd, c);
+        if (type == COMMAND_TYPE_COMMENT)
+            break;
+        if (cmd == NULL || type == COMMAND_TYPE_UNKNOWN) {
+            printf("Syntax error near unexpected token `%s'\n", tokenName(type));
+            list.size = 0;
+            return list;
+        }
+        cmd = NULL;
+        operatorPending = type != COMMAND_TYPE_BACKGROUND;
+        if (type == COMMAND_TYPE_OPERATOR_AND || type == COMMAND_TYPE_OPERATOR_OR) {
+            pipeline = NULL;
+            pending = type;
+        } else if (type == COMMAND_TYPE_BACKGROUND) {
+            andOr->background = true;
+            andOr = NULL;
+            pipeline = NULL;
+            pending = COMMAND_TYPE_OPERATOR_AND;
+        }
+    }
+    finishCommand(cmd, c);
+
+    if (operatorPending) {
+        printf("Syntax error near unexpected token `newline'\n");
+        list.size = 0;
+    }
+    return list;
+}
+
+CommandList parser(char **input) {
+    (void) input;
+    arena.tokens.size = 0;
+    arena.wordsLen = 0;
+    if (!readFirstLine(&arena)) {
+        CommandList empty = {0};
+        return empty;
+    }
+    tokenize(&arena, 0);
+    historyCommit();
+
+    NodeCursor c = reserveNodes(&arena, arena.tokens.size);
+    return buildList(&arena, 0, arena.tokens.size, &c);
+}
+
+bool parserEof() {
+    return eofReached;
+}
+
+void parser_free(CommandList *const ptr) {
+    arena.textLen = 0;
+    arena.wordsLen = 0;
+    arena.tokens.size = 0;
+    ptr->lists = NULL;
+    ptr->size = 0;
+}
+
+CommandScript parserParseScript(char *text, size_t len) {
+    CommandScript script = {0};
+    ParserArena *a = (ParserArena *) calloc(1, sizeof(ParserArena));
+    a->text = text;
+    a->textLen = len;
+
+    // Token index where each line starts, one more entry marks the end of the last line
+    SMALL_VECTOR(size_t, INITIAL_SEQUENCE_SIZE) lineStarts = {0};
+    size_t pos = 0;
+    while (true) {
+        size_t *lineStart = smallVectorPush(&lineStarts);
+        if (lineStart == NULL) {
+            printf("Failed to allocate parser arena\n");
+            exit(EXIT_FAILURE);
         }
+        *lineStart = a->tokens.size;
+        if (pos >= len || text[pos] == 0)
+            break;
+        pos = tokenize(a, pos);
+        script.size++;
+    }
+    if (a->unterminated) {
+        printf("Unexpected end of script\n");
+        exit(EXIT_FAILURE);
     }
 
-    for (size_t i = 0; i < argCount; i++) {
-        free(argList[i]);
+    script.lines = (CommandList *) calloc(script.size, sizeof(CommandList));
+    NodeCursor c = reserveNodes(a, a->tokens.size);
+    for (size_t i = 0; i < script.size; i++) {
+        script.lines[i] = buildList(a, lineStarts.data[i], lineStarts.data[i + 1], &c);
     }
-    free(argList);
+    smallVectorFree(&lineStarts);
+    script.arena = a;
+    return script;
+}
 
-    return ca;
+bool parserTokenizeBuffer(char *text, size_t len, const ParserToken **tokens, size_t *count) {
+    static ParserArena a = {0};
+    static SMALL_VECTOR(ParserToken, 1) result = {0};
+    a.text = text;
+    a.textLen = len;
+    a.wordsLen = 0;
+    a.tokens.size = 0;
+    a.unterminated = false;
+
+    size_t pos = 0;
+    while (pos < len && text[pos] != 0) {
+        pos = tokenize(&a, pos);
+    }
+    if (!smallVectorReserve(&result, a.tokens.size)) {
+        printf("Failed to allocate parser arena\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < a.tokens.size; i++) {
+        Token *token = &a.tokens.data[i];
+        bool hasText = token->type == COMMAND_TYPE_REGULAR || token->type == COMMAND_TYPE_SUBSHELL;
+        result.data[i].type = token->type;
+        result.data[i].word = hasText ? wordOf(&a, token) : NULL;
+    }
+    result.size = a.tokens.size;
+    *tokens = result.data;
+    *count = result.size;
+    return !a.unterminated;
 }
 
-void parser_free(CommandArray *const ptr) {
+void parserFreeScript(CommandScript *script) {
+    ParserArena *a = (ParserArena *) script->arena;
+    smallVectorFree(&a->tokens);
+    free(a->words);
+    free(a->block);
+    free(a);
+    free(script->lines);
+    script->lines = NULL;
+    script->size = 0;
+    script->arena = NULL;
 }
 /*
 
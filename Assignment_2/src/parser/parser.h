@@ -4,6 +4,8 @@
 
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 typedef enum {
     COMMAND_TYPE_REGULAR,
@@ -14,32 +16,83 @@ typedef enum {
     COMMAND_TYPE_OPERATOR_WRITE,
     COMMAND_TYPE_BACKGROUND,
     COMMAND_TYPE_COMMENT,
+    // ( ... ), the token is the text between the parentheses
+    COMMAND_TYPE_SUBSHELL,
     COMMAND_TYPE_UNKNOWN,
 
     COMMAND_TYPE_MAX
 } CommandType;
 
 typedef struct {
+    // COMMAND_TYPE_OPERATOR_WRITE or COMMAND_TYPE_OPERATOR_APPEND
     uint32_t type;
+    char *target;
+} Redirection;
 
+// Simple command: words and redirections of its stdout, the last redirection wins
+typedef struct {
     size_t argc;
-    size_t argCapacity;
     char *name;
+    // Null-terminated
     char **argv;
+    Redirection *redirections;
+    size_t redirectionCount;
+    // Words or redirection targets refer to variables, they are expanded with varsExpand right before the run
+    bool expand;
+    // Text of ( ... ), run by a forked shell instead of argv, which is empty then
+    char *subshell;
 } Command;
 
 typedef struct {
-    Command *tokens;
+    Command *commands;
+    size_t size;
+    // Operator before the pipeline in and-or list: COMMAND_TYPE_OPERATOR_AND or _OR, the first one has AND
+    uint32_t connector;
+} Pipeline;
+
+typedef struct {
+    Pipeline *pipelines;
+    size_t size;
+    // Terminated by &
+    bool background;
+} AndOrList;
+
+// Command line: and-or lists separated by &
+typedef struct {
+    AndOrList *lists;
+    size_t size;
+} CommandList;
+
+// Token of parserTokenizeBuffer: text of a word or a subshell, NULL for operators and comments
+typedef struct {
+    uint32_t type;
+    const char *word;
+} ParserToken;
+
+// Command lines of a whole script
+typedef struct {
+    CommandList *lines;
     size_t size;
-    size_t capacity;
-} CommandArray;
+    void *arena;
+} CommandScript;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-CommandArray parser(char **input);
-void parser_free(CommandArray *const ptr);
+// Reads a command line from stdin and parses it. The AST lives in the parser arena until parser_free()
+CommandList parser(char **input);
+void parser_free(CommandList *const ptr);
+// True once stdin has no more command lines
+bool parserEof();
+// Parses all lines of the script at once. Text is tokenized in place, so it must stay alive while the script is used.
+CommandScript parserParseScript(char *text, size_t len);
+void parserFreeScript(CommandScript *script);
+/*
+ * Tokenizes the text in place like a script, without building the AST, for the fuzz harness. Tokens are valid until
+ * the next call. Returns false if the text ends inside quotes or parentheses.
+ */
+bool parserTokenizeBuffer(char *text, size_t len, const ParserToken **tokens, size_t *count);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "vars.h"
+
+#define INITIAL_TABLE_CAPACITY 64
+// Table is grown when it is filled more than by MAX_LOAD_NUM / MAX_LOAD_DEN
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 10
+#define INITIAL_EXPANSION_SIZE 64
+
+extern char **environ;
+
+typedef struct {
+    char *name;
+    // NULL once the variable is unset, the name stays in its slot so probing goes on past it
+    char *value;
+    bool exported;
+} Variable;
+
+typedef struct {
+    Variable *entries;
+    size_t capacity;
+    size_t size;
+    bool imported;
+
+    // NAME=value strings of exported variables, rebuilt when dirty
+    char **envp;
+    bool envpDirty;
+
+    int lastStatus;
+    // Pid of the shell the user has started, forked subshells keep it
+    int shellPid;
+    char special[32];
+    // Statuses of stages of the last foreground pipeline, PIPESTATUS is built from them on use
+    int *pipeStatus;
+    size_t pipeStatusSize;
+    char *pipeStatusText;
+} VariableTable;
+
+static VariableTable table = {.envpDirty = true};
+
+static uint64_t hashName(const char *name, size_t len) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static Variable *findSlot(Variable *entries, size_t capacity, const char *name, size_t len) {
+    size_t i = hashName(name, len) & (capacity - 1);
+    while (entries[i].name != NULL && (strncmp(entries[i].name, name, len) != 0 || entries[i].name[len] != 0)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &entries[i];
+}
+
+static bool growTable() {
+    size_t newCapacity = table.capacity == 0 ? INITIAL_TABLE_CAPACITY : table.capacity * 2;
+    Variable *newEntries = (Variable *) calloc(newCapacity, sizeof(Variable));
+    if (newEntries == NULL) {
+        printf("Failed to allocate variable table\n");
+        return false;
+    }
+    for (size_t i = 0; i < table.capacity; i++) {
+        Variable *v = &table.entries[i];
+        if (v->name != NULL) {
+            *findSlot(newEntries, newCapacity, v->name, strlen(v->name)) = *v;
+        }
+    }
+    free(table.entries);
+    table.entries = newEntries;
+    table.capacity = newCapacity;
+    return true;
+}
+
+static Variable *lookup(const char *name, size_t len);
+
+/* Imports the environment the shell was started with, every variable of it is exported. */
+static void importEnvironment() {
+    table.imported = true;
+    for (char **env = environ; env != NULL && *env != NULL; env++) {
+        const char *eq = strchr(*env, '=');
+        if (eq == NULL || !varsIsName(*env, eq - *env))
+            continue;
+        Variable *v = lookup(*env, eq - *env);
+        if (v == NULL)
+            return;
+        free(v->value);
+        v->value = strdup(eq + 1);
+        v->exported = true;
+    }
+}
+
+/* Returns the slot of the variable, adding the name if it is not in the table yet. */
+static Variable *lookup(const char *name, size_t len) {
+    if (!table.imported) {
+        importEnvironment();
+    }
+    if ((table.size + 1) * MAX_LOAD_DEN > table.capacity * MAX_LOAD_NUM && !growTable()) {
+        return NULL;
+    }
+    Variable *v = findSlot(table.entries, table.capacity, name, len);
+    if (v->name == NULL) {
+        v->name = strndup(name, len);
+        table.size++;
+    }
+    return v;
+}
+
+#define PIPESTATUS "PIPESTATUS"
+
+/* PIPESTATUS: statuses of all stages separated by spaces, PIPESTATUS_n: status of the stage n, from 0 */
+static const char *pipeStatus(const char *name, size_t len) {
+    size_t prefixLen = strlen(PIPESTATUS);
+    if (len < prefixLen || strncmp(name, PIPESTATUS, prefixLen) != 0)
+        return NULL;
+    if (len == prefixLen) {
+        char *text = (char *) realloc(table.pipeStatusText, table.pipeStatusSize * 12 + 1);
+        if (text == NULL)
+            return NULL;
+        table.pipeStatusText = text;
+        text[0] = 0;
+        for (size_t i = 0; i < table.pipeStatusSize; i++) {
+            text += sprintf(text, i > 0 ? " %d" : "%d", table.pipeStatus[i]);
+        }
+        return table.pipeStatusText;
+    }
+    if (name[prefixLen] != '_' || len == prefixLen + 1)
+        return NULL;
+    size_t stage = 0;
+    for (size_t i = prefixLen + 1; i < len; i++) {
+        if (name[i] < '0' || name[i] > '9' || stage > table.pipeStatusSize)
+            return NULL;
+        stage = stage * 10 + (name[i] - '0');
+    }
+    if (stage >= table.pipeStatusSize)
+        return NULL;
+    snprintf(table.special, sizeof(table.special), "%d", table.pipeStatus[stage]);
+    return table.special;
+}
+
+static const char *special(const char *name, size_t len) {
+    if (len > 1)
+        return pipeStatus(name, len);
+    if (len != 1)
+        return NULL;
+    if (name[0] == '?') {
+        snprintf(table.special, sizeof(table.special), "%d", table.lastStatus);
+        return table.special;
+    }
+    if (name[0] == '$') {
+        snprintf(table.special, sizeof(table.special), "%d", table.shellPid != 0 ? table.shellPid : (int) getpid());
+        return table.special;
+    }
+    return NULL;
+}
+
+static const char *get(const char *name, size_t len) {
+    const char *value = special(name, len);
+    if (value != NULL)
+        return value;
+    if (!table.imported) {
+        importEnvironment();
+    }
+    if (table.capacity == 0)
+        return NULL;
+    return findSlot(table.entries, table.capacity, name, len)->value;
+}
+
+const char *varsGet(const char *name) {
+    return get(name, strlen(name));
+}
+
+bool varsSet(const char *name, const char *value, bool exported) {
+    Variable *v = lookup(name, strlen(name));
+    if (v == NULL)
+        return false;
+    char *copy = strdup(value);
+    if (copy == NULL)
+        return false;
+    free(v->value);
+    v->value = copy;
+    v->exported = v->exported || exported;
+    table.envpDirty = table.envpDirty || v->exported;
+    return true;
+}
+
+bool varsExport(const char *name) {
+    Variable *v = lookup(name, strlen(name));
+    if (v == NULL)
+        return false;
+    if (!v->exported) {
+        v->exported = true;
+        table.envpDirty = table.envpDirty || v->value != NULL;
+    }
+    return true;
+}
+
+bool varsIsExported(const char *name) {
+    if (!table.imported) {
+        importEnvironment();
+    }
+    if (table.capacity == 0)
+        return false;
+    return findSlot(table.entries, table.capacity, name, strlen(name))->exported;
+}
+
+void varsUnset(const char *name) {
+    if (!table.imported) {
+        importEnvironment();
+    }
+    if (table.capacity == 0)
+        return;
+    Variable *v = findSlot(table.entries, table.capacity, name, strlen(name));
+    if (v->name == NULL)
+        return;
+    table.envpDirty = table.envpDirty || (v->exported && v->value != NULL);
+    free(v->value);
+    v->value = NULL;
+    v->exported = false;
+}
+
+void varsSetShellPid(int pid) {
+    table.shellPid = pid;
+}
+
+void varsSetLastStatus(int status) {
+    table.lastStatus = status;
+}
+
+void varsSetPipeStatus(const int *statuses, size_t count) {
+    if (count > table.pipeStatusSize) {
+        int *newStatus = (int *) realloc(table.pipeStatus, count * sizeof(int));
+        if (newStatus == NULL)
+            return;
+        table.pipeStatus = newStatus;
+    }
+    memcpy(table.pipeStatus, statuses, count * sizeof(int));
+    table.pipeStatusSize = count;
+}
+
+bool varsIsName(const char *name, size_t len) {
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        char ch = name[i];
+        bool valid = ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9');
+        if (!valid)
+            return false;
+    }
+    return true;
+}
+
+bool varsIsAssignment(const char *word) {
+    const char *eq = strchr(word, '=');
+    return eq != NULL && varsIsName(word, eq - word);
+}
+
+static void freeEnvironment() {
+    if (table.envp == NULL)
+        return;
+    for (char **env = table.envp; *env != NULL; env++) {
+        free(*env);
+    }
+    free(table.envp);
+    table.envp = NULL;
+}
+
+char **varsEnvironment() {
+    if (!table.imported) {
+        importEnvironment();
+    }
+    if (!table.envpDirty)
+        return table.envp;
+
+    size_t count = 0;
+    for (size_t i = 0; i < table.capacity; i++) {
+        if (table.entries[i].exported && table.entries[i].value != NULL)
+            count++;
+    }
+    char **envp = (char **) calloc(count + 1, sizeof(char *));
+    if (envp == NULL) {
+        printf("Failed to allocate environment\n");
+        return table.envp != NULL ? table.envp : environ;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < table.capacity; i++) {
+        Variable *v = &table.entries[i];
+        if (!v->exported || v->value == NULL)
+            continue;
+        size_t nameLen = strlen(v->name);
+        size_t valueLen = strlen(v->value);
+        char *entry = (char *) malloc(nameLen + valueLen + 2);
+        if (entry == NULL)
+            continue;
+        memcpy(entry, v->name, nameLen);
+        entry[nameLen] = '=';
+        memcpy(entry + nameLen + 1, v->value, valueLen + 1);
+        envp[n++] = entry;
+    }
+    freeEnvironment();
+    table.envp = envp;
+    table.envpDirty = false;
+    return envp;
+}
+
+char *varsExpand(const char *word, VarsCommandRunner runCommand) {
+    size_t capacity = INITIAL_EXPANSION_SIZE;
+    size_t len = 0;
+    char *result = (char *) malloc(capacity);
+    if (result == NULL)
+        return NULL;
+
+    const char *p = word;
+    while (*p != 0) {
+        const char *chunk = p;
+        size_t chunkLen;
+        char *output = NULL;
+        if (*p == VARS_COMMAND_MARKER) {
+            const char *command = p + 1;
+            const char *end = strchr(command, VARS_COMMAND_MARKER);
+            if (end == NULL)
+                end = command + strlen(command);
+            output = runCommand != NULL ? runCommand(command, end - command) : NULL;
+            chunk = output;
+            chunkLen = output != NULL ? strlen(output) : 0;
+            p = *end != 0 ? end + 1 : end;
+        } else if (*p == VARS_MARKER) {
+            const char *name = p + 1;
+            const char *end = strchr(name, VARS_MARKER);
+            if (end == NULL)
+                end = name + strlen(name);
+            chunk = get(name, end - name);
+            chunkLen = chunk != NULL ? strlen(chunk) : 0;
+            p = *end != 0 ? end + 1 : end;
+        } else {
+            static const char markers[] = {VARS_MARKER, VARS_COMMAND_MARKER, 0};
+            chunkLen = strcspn(p, markers);
+            p += chunkLen;
+        }
+
+        if (len + chunkLen + 1 > capacity) {
+            while (len + chunkLen + 1 > capacity)
+                capacity *= 2;
+            char *newResult = (char *) realloc(result, capacity);
+            if (newResult == NULL) {
+                free(output);
+                free(result);
+                return NULL;
+            }
+            result = newResult;
+        }
+        if (chunkLen > 0)
+            memcpy(result + len, chunk, chunkLen);
+        len += chunkLen;
+        free(output);
+    }
+    result[len] = 0;
+    return result;
+}
+
+void varsPrintExported(FILE *out) {
+    if (!table.imported) {
+        importEnvironment();
+    }
+    for (size_t i = 0; i < table.capacity; i++) {
+        Variable *v = &table.entries[i];
+        if (v->exported && v->value != NULL)
+            fprintf(out, "export %s=\"%s\"\n", v->name, v->value);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shell variables: name -> value, with a flag telling whether the variable is exported to commands.
+ * The table is filled from the environment of the shell on first use. Exported variables are materialized
+ * into an envp array only after one of them has changed, so launching a command doesn't rebuild it.
+ */
+
+// Marks a variable reference inside a parsed word: VARS_MARKER name VARS_MARKER
+#define VARS_MARKER '\x01'
+// Marks a command substitution: VARS_COMMAND_MARKER command VARS_COMMAND_MARKER
+#define VARS_COMMAND_MARKER '\x02'
+
+// Runs the command of $(...) and returns its output, allocated with malloc
+typedef char *(*VarsCommandRunner)(const char *command, size_t len);
+
+// Returns the value owned by the table, NULL if the variable is not set.
+// Special parameters: $? is the status of the last pipeline, $$ is the pid of the shell.
+const char *varsGet(const char *name);
+// Sets the variable, exported ones keep the flag
+bool varsSet(const char *name, const char *value, bool exported);
+bool varsExport(const char *name);
+bool varsIsExported(const char *name);
+void varsUnset(const char *name);
+// $$ expands to the pid, also in forked subshells. Set once at startup.
+void varsSetShellPid(int pid);
+void varsSetLastStatus(int status);
+// Statuses of stages of the last foreground pipeline: $PIPESTATUS has all of them, $PIPESTATUS_n the stage n
+void varsSetPipeStatus(const int *statuses, size_t count);
+
+// NAME=value where NAME is a valid identifier
+bool varsIsAssignment(const char *word);
+// Checks that len characters of the name form an identifier: letters, digits and '_', not starting with a digit
+bool varsIsName(const char *name, size_t len);
+
+// Environment for execve and posix_spawn, owned by the table
+char **varsEnvironment();
+// Returns the word with references replaced by values and substitutions by output of runCommand,
+// allocated with malloc
+char *varsExpand(const char *word, VarsCommandRunner runCommand);
+// export without arguments
+void varsPrintExported(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif